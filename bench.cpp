@@ -0,0 +1,741 @@
+#include <getopt.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crc.h"
+#include "fft.h"
+#include "matmul.h"
+#include "numtheory.h"
+#include "sort.h"
+#include "stream.h"
+
+// Microbenchmarks of the optimized load kernels against the versions they
+// replace. Each one checks that both give the same results before timing them,
+// and prints a CSV row per problem size.
+
+static const char* gArgv0 = "bench";
+static int gReps = 3;
+static uint64_t gSeed = 1;
+
+static void
+Abort(const char* aFormat, ...)
+{
+    va_list vargs;
+    va_start(vargs, aFormat);
+    fprintf(stderr, "%s: ", gArgv0);
+    vfprintf(stderr, aFormat, vargs);
+    fprintf(stderr, "\n");
+    va_end(vargs);
+
+    exit(1);
+}
+
+static int64_t
+MonotonicNow_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// The same xorshift64* generator as the load driver's.
+static uint32_t
+NextRandom(uint64_t& aState)
+{
+    aState ^= aState >> 12;
+    aState ^= aState << 25;
+    aState ^= aState >> 27;
+    return uint32_t((aState * 2685821657736338717ULL) >> 32);
+}
+
+// This class times a function over --reps runs and keeps the fastest, which
+// is the least disturbed by everything else running on the machine.
+class BestOf
+{
+    int64_t mBest_ns;
+    int64_t mStart_ns;
+
+public:
+    BestOf() : mBest_ns(INT64_MAX), mStart_ns(0) {}
+
+    void Start() { mStart_ns = MonotonicNow_ns(); }
+    void Stop()
+    {
+        int64_t elapsed_ns = MonotonicNow_ns() - mStart_ns;
+        if (elapsed_ns < mBest_ns) {
+            mBest_ns = elapsed_ns;
+        }
+    }
+    double Seconds() const { return mBest_ns / 1e9; }
+};
+
+// The modulus of load.cpp's matrices.
+static const uint32_t kMatrixMod = 10000;
+
+static void
+BenchMatMul(const long* aSizes, int aNumSizes)
+{
+    static const long kDefaultSizes[] = { 64, 100, 128, 256, 512 };
+    if (aNumSizes == 0) {
+        aSizes = kDefaultSizes;
+        aNumSizes = sizeof(kDefaultSizes) / sizeof(kDefaultSizes[0]);
+    }
+
+    printf("n,naive_ms,blocked_ms,avx2_ms,naive_gops,blocked_gops,avx2_gops\n");
+    for (int s = 0; s < aNumSizes; s++) {
+        int n = int(aSizes[s]);
+        size_t entries = size_t(n) * n;
+        uint32_t* a = new uint32_t[entries];
+        uint32_t* b = new uint32_t[entries];
+        uint32_t* expected = new uint32_t[entries];
+        uint32_t* c = new uint32_t[entries];
+        uint64_t random = gSeed * 0x9E3779B97F4A7C15ULL | 1;
+        for (size_t i = 0; i < entries; i++) {
+            a[i] = NextRandom(random) % kMatrixMod;
+            b[i] = NextRandom(random) % kMatrixMod;
+        }
+
+        ModMatMul matmul(n, kMatrixMod);
+        bool haveAVX2 = matmul.UsesAVX2();
+        BestOf naive, blocked, avx2;
+        for (int r = 0; r < gReps; r++) {
+            naive.Start();
+            ModMatMulNaive(a, b, expected, n, kMatrixMod);
+            naive.Stop();
+
+            if (haveAVX2) {
+                avx2.Start();
+                matmul.Multiply(a, b, c);
+                avx2.Stop();
+                if (memcmp(c, expected, entries * sizeof(uint32_t)) != 0) {
+                    Abort("matmul: the AVX2 product differs for n=%d", n);
+                }
+            }
+        }
+        matmul.DisableAVX2();
+        for (int r = 0; r < gReps; r++) {
+            blocked.Start();
+            matmul.Multiply(a, b, c);
+            blocked.Stop();
+            if (memcmp(c, expected, entries * sizeof(uint32_t)) != 0) {
+                Abort("matmul: the blocked product differs for n=%d", n);
+            }
+        }
+
+        // Each product is n^3 multiply-adds.
+        double ops = double(n) * n * n;
+        printf("%d,%.3f,%.3f,", n, naive.Seconds() * 1e3, blocked.Seconds() * 1e3);
+        if (haveAVX2) {
+            printf("%.3f,", avx2.Seconds() * 1e3);
+        } else {
+            printf(",");
+        }
+        printf("%.2f,%.2f,", ops / naive.Seconds() / 1e9,
+               ops / blocked.Seconds() / 1e9);
+        if (haveAVX2) {
+            printf("%.2f\n", ops / avx2.Seconds() / 1e9);
+        } else {
+            printf("\n");
+        }
+        fflush(stdout);
+
+        delete[] a;
+        delete[] b;
+        delete[] expected;
+        delete[] c;
+    }
+
+    // Check that Power() agrees with multiplying the naive way.
+    static const int kPowerN = 37;
+    static const int kPowerExp = 13;
+    size_t entries = kPowerN * kPowerN;
+    uint32_t a[kPowerN * kPowerN], expected[kPowerN * kPowerN];
+    uint32_t power[kPowerN * kPowerN];
+    uint64_t random = gSeed | 1;
+    for (size_t i = 0; i < entries; i++) {
+        a[i] = expected[i] = NextRandom(random) % kMatrixMod;
+    }
+    for (int i = 1; i < kPowerExp; i++) {
+        ModMatMulNaive(expected, a, power, kPowerN, kMatrixMod);
+        memcpy(expected, power, sizeof(power));
+    }
+    ModMatMul matmul(kPowerN, kMatrixMod);
+    matmul.Power(a, kPowerExp, power);
+    if (memcmp(power, expected, sizeof(power)) != 0) {
+        Abort("matmul: Power() differs from repeated multiplication");
+    }
+}
+
+// Returns the largest difference between |aRe|/|aIm| and |aExpected|, relative
+// to the largest magnitude in |aExpected|.
+static double
+RelativeError(const double* aRe, const double* aIm, const COMPLEX* aExpected,
+              size_t aCount)
+{
+    double maxError = 0, maxValue = 0;
+    for (size_t i = 0; i < aCount; i++) {
+        double error = hypot(aRe[i] - aExpected[i].re, aIm[i] - aExpected[i].im);
+        double value = hypot(aExpected[i].re, aExpected[i].im);
+        maxError = error > maxError ? error : maxError;
+        maxValue = value > maxValue ? value : maxValue;
+    }
+    return maxValue > 0 ? maxError / maxValue : maxError;
+}
+
+static void
+BenchFFT(const long* aSizes, int aNumSizes)
+{
+    static const long kDefaultSizes[] = {
+        10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22
+    };
+    if (aNumSizes == 0) {
+        aSizes = kDefaultSizes;
+        aNumSizes = sizeof(kDefaultSizes) / sizeof(kDefaultSizes[0]);
+    }
+
+    printf("power,legacy_ms,plan_ms,avx2_ms,plan_speedup,avx2_speedup\n");
+    for (int s = 0; s < aNumSizes; s++) {
+        int power = int(aSizes[s]);
+        if (power > 26) {
+            Abort("fft: 2^%d points is too many", power);
+        }
+        size_t count = size_t(1) << power;
+        COMPLEX* input = new COMPLEX[count];
+        COMPLEX* expected = new COMPLEX[count];
+        double* re = new double[count];
+        double* im = new double[count];
+        uint64_t random = gSeed * 0x9E3779B97F4A7C15ULL | 1;
+        for (size_t i = 0; i < count; i++) {
+            input[i].re = NextRandom(random) / 4294967296.0 - 0.5;
+            input[i].im = NextRandom(random) / 4294967296.0 - 0.5;
+        }
+
+        BestOf legacy, plain, avx2;
+        for (int r = 0; r < gReps; r++) {
+            legacy.Start();
+            FFT(input, expected, power);
+            legacy.Stop();
+        }
+
+        // The plan is made once, outside the timing, as a user would.
+        FFTPlan plan(power);
+        bool haveAVX2 = plan.UsesAVX2();
+        for (int pass = haveAVX2 ? 0 : 1; pass < 2; pass++) {
+            if (pass == 1) {
+                plan.DisableAVX2();
+            }
+            BestOf& best = pass == 0 ? avx2 : plain;
+            for (int r = 0; r < gReps; r++) {
+                for (size_t i = 0; i < count; i++) {
+                    re[i] = input[i].re;
+                    im[i] = input[i].im;
+                }
+                best.Start();
+                plan.Forward(re, im);
+                best.Stop();
+                // FFT() uses an approximation of pi, so allow for that.
+                if (RelativeError(re, im, expected, count) > 1e-9) {
+                    Abort("fft: the %s transform differs for 2^%d points",
+                          pass == 0 ? "AVX2" : "scalar", power);
+                }
+            }
+            plan.Inverse(re, im);
+            if (RelativeError(re, im, input, count) > 1e-12) {
+                Abort("fft: the %s inverse transform differs for 2^%d points",
+                      pass == 0 ? "AVX2" : "scalar", power);
+            }
+        }
+
+        printf("%d,%.3f,%.3f,", power, legacy.Seconds() * 1e3,
+               plain.Seconds() * 1e3);
+        if (haveAVX2) {
+            printf("%.3f,", avx2.Seconds() * 1e3);
+        } else {
+            printf(",");
+        }
+        printf("%.2f,", legacy.Seconds() / plain.Seconds());
+        if (haveAVX2) {
+            printf("%.2f\n", legacy.Seconds() / avx2.Seconds());
+        } else {
+            printf("\n");
+        }
+        fflush(stdout);
+
+        delete[] input;
+        delete[] expected;
+        delete[] re;
+        delete[] im;
+    }
+}
+
+static void
+BenchCrc(const long* aSizes, int aNumSizes)
+{
+    static const long kDefaultSizes[] = {
+        64, 1 << 10, 1 << 16, 1 << 20, 1 << 26
+    };
+    static const Crc32::Method kMethods[] = {
+        Crc32::Bytewise, Crc32::Slicing8, Crc32::Slicing16, Crc32::Clmul
+    };
+    static const int kNumMethods = sizeof(kMethods) / sizeof(kMethods[0]);
+    if (aNumSizes == 0) {
+        aSizes = kDefaultSizes;
+        aNumSizes = sizeof(kDefaultSizes) / sizeof(kDefaultSizes[0]);
+    }
+    if (!Crc32::HasClmul()) {
+        fprintf(stderr, "crc: no PCLMULQDQ, so clmul is slicing-by-16\n");
+    }
+
+    printf("bytes,legacy_gbps,bytewise_gbps,slicing8_gbps,slicing16_gbps,"
+           "clmul_gbps\n");
+    for (int s = 0; s < aNumSizes; s++) {
+        size_t bytes = size_t(aSizes[s]);
+        if (bytes > UINT32_MAX) {
+            Abort("crc: crc32() can't take %zu bytes", bytes);
+        }
+        unsigned char* buf = new unsigned char[bytes];
+        uint64_t random = gSeed * 0x9E3779B97F4A7C15ULL | 1;
+        for (size_t i = 0; i < bytes; i++) {
+            buf[i] = (unsigned char)NextRandom(random);
+        }
+        uint32_t expected = crc32(buf, uint32_t(bytes));
+
+        // Every method has to agree with crc32(), also when the buffer comes
+        // in uneven pieces.
+        for (int m = 0; m < kNumMethods; m++) {
+            Crc32 crc;
+            size_t offset = 0;
+            while (offset < bytes) {
+                size_t piece = NextRandom(random) % 4096;
+                if (piece > bytes - offset) {
+                    piece = bytes - offset;
+                }
+                crc.Update(buf + offset, piece, kMethods[m]);
+                offset += piece;
+            }
+            if (crc.Value() != expected ||
+                Crc32::Compute(buf, bytes, kMethods[m]) != expected) {
+                Abort("crc: method %d differs from crc32() for %zu bytes",
+                      int(kMethods[m]), bytes);
+            }
+        }
+
+        // Small buffers are repeated, so that each timing is long enough.
+        long repeat = long((1 << 24) / bytes);
+        if (repeat < 1) {
+            repeat = 1;
+        }
+        double total = double(bytes) * repeat;
+        volatile uint32_t sink = 0;
+        BestOf legacy;
+        for (int r = 0; r < gReps; r++) {
+            legacy.Start();
+            for (long i = 0; i < repeat; i++) {
+                sink = sink + crc32(buf, uint32_t(bytes));
+            }
+            legacy.Stop();
+        }
+        printf("%zu,%.3f", bytes, total / legacy.Seconds() / 1e9);
+        for (int m = 0; m < kNumMethods; m++) {
+            BestOf best;
+            for (int r = 0; r < gReps; r++) {
+                best.Start();
+                for (long i = 0; i < repeat; i++) {
+                    sink = sink + Crc32::Compute(buf, bytes, kMethods[m]);
+                }
+                best.Stop();
+            }
+            printf(",%.3f", total / best.Seconds() / 1e9);
+        }
+        printf("\n");
+        fflush(stdout);
+        delete[] buf;
+    }
+}
+
+// The sorts the sort benchmark compares, with the size above which each one
+// is skipped for the inputs where it is quadratic.
+static void SortQuick(int* aData, size_t aLen, int*) { quick_sort(aData, int(aLen)); }
+static void SortHeap(int* aData, size_t aLen, int*) { heap_sort(aData, int(aLen)); }
+static void SortBubble(int* aData, size_t aLen, int*) { bubble_sort(aData, int(aLen)); }
+static void SortIntro(int* aData, size_t aLen, int*) { IntroSort(aData, aLen); }
+static void SortRadix(int* aData, size_t aLen, int* aScratch) { RadixSort(aData, aLen, aScratch); }
+static int gSortThreads = 1;
+static void SortSample(int* aData, size_t aLen, int*) { SampleSort(aData, aLen, gSortThreads); }
+
+struct SortCase
+{
+    const char* mName;
+    void (*mSort)(int* aData, size_t aLen, int* aScratch);
+    size_t mQuadraticMax;           // 0 if it's never quadratic.
+    bool mQuadraticOnRandom;
+};
+
+static const SortCase kSorts[] = {
+    // quick_sort() takes the last key as the pivot, and puts keys equal to it
+    // on one side.
+    { "quick_sort", SortQuick,  1 << 16, false },
+    { "heap_sort",  SortHeap,   0,       false },
+    { "bubble_sort", SortBubble, 1 << 14, true },
+    { "introsort",  SortIntro,  0,       false },
+    { "radix",      SortRadix,  0,       false },
+    { "sample",     SortSample, 0,       false },
+};
+static const int kNumSorts = sizeof(kSorts) / sizeof(kSorts[0]);
+
+static void
+BenchSort(const long* aSizes, int aNumSizes)
+{
+    static const long kDefaultSizes[] = { 1000, 10000, 100000, 1000000 };
+    if (aNumSizes == 0) {
+        aSizes = kDefaultSizes;
+        aNumSizes = sizeof(kDefaultSizes) / sizeof(kDefaultSizes[0]);
+    }
+    gSortThreads = int(sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(stderr, "sort: sample sort on %d threads\n", gSortThreads);
+
+    printf("n,input");
+    for (int k = 0; k < kNumSorts; k++) {
+        printf(",%s_ns", kSorts[k].mName);
+    }
+    printf("\n");
+    for (int s = 0; s < aNumSizes; s++) {
+        size_t n = size_t(aSizes[s]);
+        if (n > INT32_MAX) {
+            Abort("sort: the legacy sorts can't sort %zu keys", n);
+        }
+        int* input = new int[n];
+        int* expected = new int[n];
+        int* work = new int[n];
+        int* scratch = new int[n];
+        for (int in = 0; in < kNumSortInputs; in++) {
+            MakeSortInput(input, n, SortInput(in), gSeed);
+            printf("%zu,%s", n, kSortInputNames[in]);
+            bool haveExpected = false;
+            for (int k = 0; k < kNumSorts; k++) {
+                const SortCase& sort = kSorts[k];
+                bool quadratic = sort.mQuadraticOnRandom || in != kRandomInput;
+                if (sort.mQuadraticMax > 0 && quadratic &&
+                    n > sort.mQuadraticMax) {
+                    printf(",");
+                    continue;
+                }
+                BestOf best;
+                for (int r = 0; r < gReps; r++) {
+                    memcpy(work, input, n * sizeof(int));
+                    best.Start();
+                    sort.mSort(work, n, scratch);
+                    best.Stop();
+                }
+
+                // The first result is checked to be in order, and the others
+                // have to match it.
+                if (!haveExpected) {
+                    for (size_t i = 1; i < n; i++) {
+                        if (work[i - 1] > work[i]) {
+                            Abort("sort: %s is out of order for %zu %s keys",
+                                  sort.mName, n, kSortInputNames[in]);
+                        }
+                    }
+                    memcpy(expected, work, n * sizeof(int));
+                    haveExpected = true;
+                } else if (memcmp(work, expected, n * sizeof(int)) != 0) {
+                    Abort("sort: %s differs for %zu %s keys", sort.mName, n,
+                          kSortInputNames[in]);
+                }
+                printf(",%.2f", best.Seconds() * 1e9 / n);
+            }
+            printf("\n");
+            fflush(stdout);
+        }
+        delete[] input;
+        delete[] expected;
+        delete[] work;
+        delete[] scratch;
+    }
+}
+
+static void
+BenchPrime(const long* aSizes, int aNumSizes)
+{
+    static const long kDefaultSizes[] = { 100000, 1000000, 10000000, 100000000 };
+    if (aNumSizes == 0) {
+        aSizes = kDefaultSizes;
+        aNumSizes = sizeof(kDefaultSizes) / sizeof(kDefaultSizes[0]);
+    }
+    // isPrime() divides by every odd number up to n/2, so it is only timed
+    // on short ranges, and Miller-Rabin is timed on a range of this length.
+    static const uint64_t kTrialMax = 200000;
+    static const uint64_t kMillerRabinRange = 1000000;
+    int numThreads = int(sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(stderr, "prime: the threaded sieve uses %d threads\n", numThreads);
+
+    printf("low,high,primes,trial_ns,sieve_ns,sieve_threads_ns,"
+           "miller_rabin_ns\n");
+    for (int s = 0; s <= aNumSizes; s++) {
+        // The last row is far from 0, where trial division is hopeless and
+        // Miller-Rabin is checked against the sieve.
+        uint64_t low = s < aNumSizes ? 0 : 1000000000000ULL;
+        uint64_t high = s < aNumSizes ? uint64_t(aSizes[s]) : low + 10000000;
+        if (high > kMaxSieveHigh) {
+            Abort("prime: %llu is too large", (unsigned long long)high);
+        }
+        double numbers = double(high - low);
+
+        BestOf sieve, threaded, trial, millerRabin;
+        uint64_t primes = 0;
+        for (int r = 0; r < gReps; r++) {
+            sieve.Start();
+            primes = CountPrimes(low, high, 1);
+            sieve.Stop();
+            threaded.Start();
+            uint64_t count = CountPrimes(low, high, numThreads);
+            threaded.Stop();
+            if (count != primes) {
+                Abort("prime: the threaded sieve found %llu primes, not %llu",
+                      (unsigned long long)count, (unsigned long long)primes);
+            }
+        }
+        printf("%llu,%llu,%llu,", (unsigned long long)low,
+               (unsigned long long)high, (unsigned long long)primes);
+
+        if (high - low <= kTrialMax) {
+            for (int r = 0; r < gReps; r++) {
+                uint64_t count = 0;
+                trial.Start();
+                for (uint64_t n = low; n < high; n++) {
+                    // isPrime() thinks 2 is not prime.
+                    count += n == 2 || isPrime(n);
+                }
+                trial.Stop();
+                if (count != primes) {
+                    Abort("prime: isPrime() found %llu primes, not %llu",
+                          (unsigned long long)count,
+                          (unsigned long long)primes);
+                }
+            }
+            printf("%.2f,", trial.Seconds() * 1e9 / numbers);
+        } else {
+            printf(",");
+        }
+        printf("%.2f,%.2f,", sieve.Seconds() * 1e9 / numbers,
+               threaded.Seconds() * 1e9 / numbers);
+
+        uint64_t mrHigh = high - low > kMillerRabinRange ? low + kMillerRabinRange
+                                                         : high;
+        uint64_t mrPrimes = CountPrimes(low, mrHigh, numThreads);
+        for (int r = 0; r < gReps; r++) {
+            uint64_t count = 0;
+            millerRabin.Start();
+            for (uint64_t n = low; n < mrHigh; n++) {
+                count += IsPrime64(n);
+            }
+            millerRabin.Stop();
+            if (count != mrPrimes) {
+                Abort("prime: Miller-Rabin found %llu primes, not %llu",
+                      (unsigned long long)count, (unsigned long long)mrPrimes);
+            }
+        }
+        printf("%.2f\n", millerRabin.Seconds() * 1e9 / double(mrHigh - low));
+        fflush(stdout);
+    }
+
+    // The reentrant Fibonacci has to agree with the original one.
+    calculateFibonacci(0, true);
+    for (unsigned i = 1; i <= UPPER_LIMIT; i++) {
+        if (Fibonacci(i) != calculateFibonacci(i, false)) {
+            Abort("prime: Fibonacci(%u) differs from calculateFibonacci()", i);
+        }
+    }
+    if (Fibonacci(kMaxFibonacciIndex) != 12200160415121876738ULL) {
+        Abort("prime: Fibonacci(%u) is wrong", kMaxFibonacciIndex);
+    }
+}
+
+static void
+BenchStream(const long* aSizes, int aNumSizes)
+{
+    // From half of L1 to several times the last-level cache, or guesses at
+    // them if sysconf() doesn't know.
+    long l1 = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    long defaultSizes[] = {
+        (l1 > 0 ? l1 : 32 << 10) / 2,
+        (l2 > 0 ? l2 : 1 << 20) / 2,
+        (l3 > 0 ? l3 : 32 << 20) / 2,
+        (l3 > 0 ? l3 : 32 << 20) * 2,
+        (l3 > 0 ? l3 : 32 << 20) * 8,
+    };
+    if (aNumSizes == 0) {
+        aSizes = defaultSizes;
+        aNumSizes = sizeof(defaultSizes) / sizeof(defaultSizes[0]);
+    }
+    int numThreads = int(sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(stderr, "stream: the threaded runs use %d threads\n", numThreads);
+
+    // What fpeak() manages, for comparison: a thousand additions per call.
+    double_array* input = new double_array[2];
+    for (int i = 0; i < 1000; i++) {
+        input[0].arr[i] = i;
+        input[1].arr[i] = 1000 - i;
+    }
+    volatile double sink = 0;
+    BestOf legacy;
+    for (int r = 0; r < gReps; r++) {
+        legacy.Start();
+        for (int i = 0; i < 10000; i++) {
+            sink = sink + fpeak(input[0], input[1]).arr[i % 1000];
+        }
+        legacy.Stop();
+    }
+    fprintf(stderr, "stream: fpeak() does %.3f GFLOP/s\n",
+            1e7 / legacy.Seconds() / 1e9);
+    delete[] input;
+
+    // The sizes are of the three arrays together.
+    printf("bytes,op,scalar_gbps,simd_gbps,threads_gbps,threads_gflops\n");
+    for (int s = 0; s < aNumSizes; s++) {
+        size_t count = size_t(aSizes[s]) / (3 * sizeof(double));
+        if (count == 0) {
+            Abort("stream: %ld bytes is too small", aSizes[s]);
+        }
+        // Arrays that fit in the caches are swept several times per timing.
+        long repeat = long((1 << 26) / (count * 3 * sizeof(double)));
+        if (repeat < 1) {
+            repeat = 1;
+        }
+        // One set of arrays at a time, since the largest take a lot of memory.
+        double seconds[kNumStreamOps][3];
+        for (int v = 0; v < 3; v++) {
+            Stream stream(count, v == 2 ? numThreads : 1);
+            if (v == 0) {
+                stream.DisableAVX2();
+            }
+            for (int op = 0; op < kNumStreamOps; op++) {
+                // Once untimed, to touch the arrays.
+                stream.Run(StreamOp(op));
+                BestOf best;
+                for (int r = 0; r < gReps; r++) {
+                    best.Start();
+                    stream.Run(StreamOp(op), repeat);
+                    best.Stop();
+                }
+                if (!stream.Check()) {
+                    Abort("stream: %s gave the wrong values for %zu doubles",
+                          kStreamOps[op].mName, count);
+                }
+                seconds[op][v] = best.Seconds();
+            }
+        }
+        for (int op = 0; op < kNumStreamOps; op++) {
+            double bytes = double(count) * kStreamOps[op].mBytes * repeat;
+            double flops = double(count) * kStreamOps[op].mFlops * repeat;
+            printf("%zu,%s,%.3f,%.3f,%.3f,%.3f\n", count * 3 * sizeof(double),
+                   kStreamOps[op].mName, bytes / seconds[op][0] / 1e9,
+                   bytes / seconds[op][1] / 1e9, bytes / seconds[op][2] / 1e9,
+                   flops / seconds[op][2] / 1e9);
+            fflush(stdout);
+        }
+    }
+}
+
+struct Benchmark
+{
+    const char* mName;
+    void (*mRun)(const long* aSizes, int aNumSizes);
+    const char* mSizeMeaning;
+};
+
+static const Benchmark kBenchmarks[] = {
+    { "matmul", BenchMatMul, "N of the N x N matrices" },
+    { "fft",    BenchFFT,    "log2 of the points" },
+    { "crc",    BenchCrc,    "bytes" },
+    { "sort",   BenchSort,   "keys" },
+    { "prime",  BenchPrime,  "the upper bound of the range" },
+    { "stream", BenchStream, "bytes in the three arrays" },
+};
+static const int kNumBenchmarks = sizeof(kBenchmarks) / sizeof(kBenchmarks[0]);
+
+static void
+Usage()
+{
+    fprintf(stderr,
+            "usage: %s [options] BENCHMARK [SIZE...]\n"
+            "\n"
+            "  --reps=N          time each case N times and keep the fastest\n"
+            "                    (default: %d)\n"
+            "  --seed=N          seed the inputs with N (default: 1)\n"
+            "  --help            print this message\n"
+            "\n"
+            "benchmarks:\n",
+            gArgv0, gReps);
+    for (int i = 0; i < kNumBenchmarks; i++) {
+        fprintf(stderr, "  %-11s size is %s\n", kBenchmarks[i].mName,
+                kBenchmarks[i].mSizeMeaning);
+    }
+}
+
+int
+main(int argc, char** argv)
+{
+    gArgv0 = argv[0];
+
+    static const struct option longOptions[] = {
+        { "reps", required_argument, NULL, 'r' },
+        { "seed", required_argument, NULL, 's' },
+        { "help", no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'r':
+            gReps = atoi(optarg);
+            if (gReps < 1) {
+                Abort("--reps must be at least 1");
+            }
+            break;
+        case 's':
+            gSeed = strtoull(optarg, NULL, 0);
+            break;
+        case 'h':
+            Usage();
+            exit(0);
+        default:
+            Usage();
+            exit(1);
+        }
+    }
+    if (optind == argc) {
+        Usage();
+        exit(1);
+    }
+
+    const Benchmark* benchmark = NULL;
+    for (int i = 0; i < kNumBenchmarks; i++) {
+        if (strcmp(argv[optind], kBenchmarks[i].mName) == 0) {
+            benchmark = &kBenchmarks[i];
+        }
+    }
+    if (!benchmark) {
+        Abort("unknown benchmark '%s'", argv[optind]);
+    }
+    int numSizes = argc - optind - 1;
+    long* sizes = new long[numSizes + 1];
+    for (int i = 0; i < numSizes; i++) {
+        sizes[i] = atol(argv[optind + 1 + i]);
+        if (sizes[i] < 1) {
+            Abort("invalid size '%s'", argv[optind + 1 + i]);
+        }
+    }
+    benchmark->mRun(sizes, numSizes);
+    delete[] sizes;
+    return 0;
+}
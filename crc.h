@@ -0,0 +1,45 @@
+#ifndef CRC_H
+#define CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The original byte-at-a-time CRC-32 (the ZMODEM/PKZIP polynomial).
+uint32_t crc32( const unsigned char *buf, uint32_t size);
+
+// This class computes the same CRC-32 as crc32(), incrementally, so that a
+// buffer can be fed to it in pieces. The default method picks the fastest
+// one the CPU supports; the others are there to compare them.
+class Crc32
+{
+    uint32_t mCrc;                  // Not yet inverted.
+
+public:
+    enum Method {
+        Auto,
+        Bytewise,                   // One table lookup per byte, as crc32().
+        Slicing8,                   // Eight tables, eight bytes at a time.
+        Slicing16,                  // Sixteen tables, sixteen bytes at a time.
+        Clmul                       // Folding with PCLMULQDQ, 64 bytes at a time.
+    };
+
+    Crc32() : mCrc(0xFFFFFFFF) {}
+
+    void Reset() { mCrc = 0xFFFFFFFF; }
+    void Update(const void* aBuf, size_t aLen, Method aMethod = Auto);
+    uint32_t Value() const { return mCrc ^ 0xFFFFFFFF; }
+
+    static uint32_t Compute(const void* aBuf, size_t aLen,
+                            Method aMethod = Auto)
+    {
+        Crc32 crc;
+        crc.Update(aBuf, aLen, aMethod);
+        return crc.Value();
+    }
+
+    // Whether the Clmul method is available; without it, Clmul falls back to
+    // Slicing16.
+    static bool HasClmul();
+};
+
+#endif // CRC_H
@@ -0,0 +1,285 @@
+#include "fft.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define FFT_HAVE_AVX2 1
+#endif
+
+// The original transform from load.cpp, which the plans are benchmarked
+// against.
+
+/*复数的加运算*/
+COMPLEX Add(COMPLEX c1, COMPLEX c2)
+{
+    COMPLEX c;
+    c.re = c1.re + c2.re;
+    c.im = c1.im + c2.im;
+    return c;
+}
+/*负数的减运算*/
+COMPLEX Sub(COMPLEX c1, COMPLEX c2)
+{
+    COMPLEX c;
+    c.re = c1.re - c2.re;
+    c.im = c1.im - c2.im;
+    return c;
+}
+/*复数的乘运算*/
+COMPLEX Mul(COMPLEX c1, COMPLEX c2)
+{
+    COMPLEX c;
+    c.re = c1.re*c2.re - c1.im*c2.im;
+    c.im = c1.re*c2.im + c1.im*c2.re;
+    return c;
+}
+
+/*快速傅立叶变换
+TD为时域值，FD为频域值，power为2的幂数*/
+void FFT(COMPLEX *TD, COMPLEX *FD, int power)
+{
+    int count;
+    int i,j,k,bfsize,p;
+    double angle;
+    COMPLEX *W,*X1,*X2,*X;
+    /*计算傅立叶变换点数*/
+    count=1<<power;
+    /*分配运算器所需存储器*/
+    W=(COMPLEX *)malloc(sizeof(COMPLEX)*count/2);
+    X1=(COMPLEX *)malloc(sizeof(COMPLEX)*count);
+    X2=(COMPLEX *)malloc(sizeof(COMPLEX)*count);
+    /*计算加权系数*/
+    for(i=0; i<count/2; i++)
+    {
+        angle = -i * 3.14159265359 * 2 / count;
+        W[i].re=cos(angle);
+        W[i].im=sin(angle);
+    }
+    /*将时域点写入存储器*/
+    memcpy(X1, TD, sizeof(COMPLEX)*count);
+    /*蝶形运算*/
+    for(k=0; k<power; k++)
+    {
+        for(j=0; j<1<<k; j++)
+        {
+            bfsize=1<<(power-k);
+            for(i=0; i<bfsize/2; i++)
+            {
+                p=j*bfsize;
+                X2[i+p]=Add(X1[i+p], X1[i+p+bfsize/2]);
+                X2[i+p+bfsize/2]=Mul(Sub(X1[i+p], X1[i+p+bfsize/2]),W[i*(1<<k)]);
+            }
+        }
+        X=X1;
+        X1=X2;
+        X2=X;
+    }
+    /*重新排序*/
+    for(j=0; j<count; j++)
+    {
+        p=0;
+        for(i=0; i<power; i++)
+        {
+            if(j&(1<<i))
+                p+=1<<(power-i-1);
+        }
+        FD[j]=X1[p];
+    }
+    /*释放存储器*/
+    free(W);
+    free(X1);
+    free(X2);
+}
+
+/*快速傅立叶反变换，利用快速傅立叶变换
+FD为频域值，TD为时域值，power为2的幂数*/
+void IFFT(COMPLEX *FD, COMPLEX *TD, int power)
+{
+    int i,count;
+    COMPLEX *x;
+    /*计算傅立叶反变换点数*/
+    count=1<<power;
+    /*分配运算所需存储器*/
+    x=(COMPLEX *)malloc(sizeof(COMPLEX)*count);
+    /*将频域点写入存储器*/
+    memcpy(x,FD,sizeof(COMPLEX)*count);
+    /*求频域点的共轭*/
+    for(i=0; i<count; i++)
+    {
+        x[i].im=-x[i].im;
+    }
+    /*调用快速傅立叶变换*/
+    FFT(x,TD,power);
+    /*求时域点的共轭*/
+    for(i=0; i<count; i++)
+    {
+        TD[i].re/=count;
+        TD[i].im=-TD[i].im/count;
+    }
+    /*释放存储器*/
+    free(x);
+}
+
+
+FFTPlan::FFTPlan(int aPower)
+  : mPower(aPower), mCount(size_t(1) << aPower), mUseAVX2(false)
+{
+    assert(aPower >= 0 && aPower < 32);
+#ifdef FFT_HAVE_AVX2
+    mUseAVX2 = __builtin_cpu_supports("avx2");
+#endif
+
+    mBitReverse = new uint32_t[mCount];
+    mBitReverse[0] = 0;
+    for (size_t i = 1; i < mCount; i++) {
+        mBitReverse[i] = (mBitReverse[i >> 1] >> 1) |
+                         (uint32_t(i & 1) << (aPower - 1));
+    }
+
+    // Stage h needs exp(-2 pi i j / 2h) for j < h.
+    size_t numTwiddles = mCount > 1 ? mCount - 1 : 1;
+    mTwiddleRe = new double[numTwiddles];
+    mTwiddleIm = new double[numTwiddles];
+    for (size_t h = 1; h < mCount; h <<= 1) {
+        for (size_t j = 0; j < h; j++) {
+            double angle = -M_PI * double(j) / double(h);
+            mTwiddleRe[h - 1 + j] = cos(angle);
+            mTwiddleIm[h - 1 + j] = sin(angle);
+        }
+    }
+}
+
+FFTPlan::~FFTPlan()
+{
+    delete[] mBitReverse;
+    delete[] mTwiddleRe;
+    delete[] mTwiddleIm;
+}
+
+// The radix-2 butterflies of the stage whose butterflies span |aHalf| points.
+static void
+Radix2Stage(double* aRe, double* aIm, size_t aCount, size_t aHalf,
+            const double* aTwiddleRe, const double* aTwiddleIm)
+{
+    for (size_t k = 0; k < aCount; k += 2 * aHalf) {
+        double* re0 = aRe + k;
+        double* im0 = aIm + k;
+        double* re1 = re0 + aHalf;
+        double* im1 = im0 + aHalf;
+        for (size_t j = 0; j < aHalf; j++) {
+            double tr = aTwiddleRe[j] * re1[j] - aTwiddleIm[j] * im1[j];
+            double ti = aTwiddleRe[j] * im1[j] + aTwiddleIm[j] * re1[j];
+            re1[j] = re0[j] - tr;
+            im1[j] = im0[j] - ti;
+            re0[j] += tr;
+            im0[j] += ti;
+        }
+    }
+}
+
+#ifdef FFT_HAVE_AVX2
+// The same as Radix2Stage(), four butterflies at a time, for stages that span
+// at least four points.
+__attribute__((target("avx2")))
+static void
+Radix2StageAVX2(double* aRe, double* aIm, size_t aCount, size_t aHalf,
+                const double* aTwiddleRe, const double* aTwiddleIm)
+{
+    for (size_t k = 0; k < aCount; k += 2 * aHalf) {
+        double* re0 = aRe + k;
+        double* im0 = aIm + k;
+        double* re1 = re0 + aHalf;
+        double* im1 = im0 + aHalf;
+        for (size_t j = 0; j < aHalf; j += 4) {
+            __m256d wr = _mm256_loadu_pd(aTwiddleRe + j);
+            __m256d wi = _mm256_loadu_pd(aTwiddleIm + j);
+            __m256d xr = _mm256_loadu_pd(re1 + j);
+            __m256d xi = _mm256_loadu_pd(im1 + j);
+            __m256d tr = _mm256_sub_pd(_mm256_mul_pd(wr, xr), _mm256_mul_pd(wi, xi));
+            __m256d ti = _mm256_add_pd(_mm256_mul_pd(wr, xi), _mm256_mul_pd(wi, xr));
+            __m256d yr = _mm256_loadu_pd(re0 + j);
+            __m256d yi = _mm256_loadu_pd(im0 + j);
+            _mm256_storeu_pd(re1 + j, _mm256_sub_pd(yr, tr));
+            _mm256_storeu_pd(im1 + j, _mm256_sub_pd(yi, ti));
+            _mm256_storeu_pd(re0 + j, _mm256_add_pd(yr, tr));
+            _mm256_storeu_pd(im0 + j, _mm256_add_pd(yi, ti));
+        }
+    }
+}
+#endif
+
+void
+FFTPlan::Transform(double* aRe, double* aIm, bool aInverse) const
+{
+    // The inverse transform is the forward one with the real and imaginary
+    // parts swapped on the way in and out, which costs nothing here.
+    if (aInverse) {
+        double* re = aRe;
+        aRe = aIm;
+        aIm = re;
+    }
+
+    for (size_t i = 0; i < mCount; i++) {
+        size_t j = mBitReverse[i];
+        if (i < j) {
+            double t = aRe[i]; aRe[i] = aRe[j]; aRe[j] = t;
+            t = aIm[i]; aIm[i] = aIm[j]; aIm[j] = t;
+        }
+    }
+
+    // The first two stages have the twiddles 1 and -i, so they are done
+    // together as a radix-4 pass without any multiplications.
+    size_t half = 1;
+    if (mPower >= 2) {
+        for (size_t k = 0; k < mCount; k += 4) {
+            double* re = aRe + k;
+            double* im = aIm + k;
+            double r0 = re[0] + re[1], i0 = im[0] + im[1];
+            double r1 = re[0] - re[1], i1 = im[0] - im[1];
+            double r2 = re[2] + re[3], i2 = im[2] + im[3];
+            double r3 = re[2] - re[3], i3 = im[2] - im[3];
+            re[0] = r0 + r2; im[0] = i0 + i2;
+            re[2] = r0 - r2; im[2] = i0 - i2;
+            // Multiplying by -i turns (r3, i3) into (i3, -r3).
+            re[1] = r1 + i3; im[1] = i1 - r3;
+            re[3] = r1 - i3; im[3] = i1 + r3;
+        }
+        half = 4;
+    }
+
+    for (; half < mCount; half <<= 1) {
+        const double* twiddleRe = mTwiddleRe + half - 1;
+        const double* twiddleIm = mTwiddleIm + half - 1;
+#ifdef FFT_HAVE_AVX2
+        if (mUseAVX2 && half >= 4) {
+            Radix2StageAVX2(aRe, aIm, mCount, half, twiddleRe, twiddleIm);
+            continue;
+        }
+#endif
+        Radix2Stage(aRe, aIm, mCount, half, twiddleRe, twiddleIm);
+    }
+
+    if (aInverse) {
+        double scale = 1.0 / mCount;
+        for (size_t i = 0; i < mCount; i++) {
+            aRe[i] *= scale;
+            aIm[i] *= scale;
+        }
+    }
+}
+
+void
+FFTPlan::Forward(double* aRe, double* aIm) const
+{
+    Transform(aRe, aIm, false);
+}
+
+void
+FFTPlan::Inverse(double* aRe, double* aIm) const
+{
+    Transform(aRe, aIm, true);
+}
@@ -0,0 +1,60 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*复数的定义*/
+typedef struct
+{
+    double re;
+    double im;
+} COMPLEX;
+
+COMPLEX Add(COMPLEX c1, COMPLEX c2);
+COMPLEX Sub(COMPLEX c1, COMPLEX c2);
+COMPLEX Mul(COMPLEX c1, COMPLEX c2);
+
+/*快速傅立叶变换
+TD为时域值，FD为频域值，power为2的幂数*/
+void FFT(COMPLEX *TD, COMPLEX *FD, int power);
+
+/*快速傅立叶反变换，利用快速傅立叶变换
+FD为频域值，TD为时域值，power为2的幂数*/
+void IFFT(COMPLEX *FD, COMPLEX *TD, int power);
+
+// This class is a plan for transforms of 2^power points, which computes the
+// twiddle factors and the bit-reversal permutation once so that each
+// transform only does the butterflies. The data is in place, as separate
+// arrays of real and imaginary parts, so the butterflies vectorize.
+//
+// Forward() computes the same transform as FFT() and Inverse() the same as
+// IFFT(), including its 1/n scaling.
+class FFTPlan
+{
+    int mPower;
+    size_t mCount;
+    uint32_t* mBitReverse;
+    // The twiddles of each radix-2 stage, one after the other: the stage
+    // whose butterflies span h points uses the h entries from h - 1.
+    double* mTwiddleRe;
+    double* mTwiddleIm;
+    bool mUseAVX2;
+
+    void Transform(double* aRe, double* aIm, bool aInverse) const;
+
+public:
+    explicit FFTPlan(int aPower);
+    ~FFTPlan();
+
+    size_t Count() const { return mCount; }
+
+    // Turns the AVX2 butterflies off, to compare them with the scalar ones.
+    void DisableAVX2() { mUseAVX2 = false; }
+    bool UsesAVX2() const { return mUseAVX2; }
+
+    void Forward(double* aRe, double* aIm) const;
+    void Inverse(double* aRe, double* aIm) const;
+};
+
+#endif // FFT_H
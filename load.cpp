@@ -7,103 +7,28 @@
 #include <math.h>
 #include <malloc.h>
 
-#define UPPER_LIMIT  92
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "crc.h"
+#include "fft.h"
+#include "matmul.h"
+#include "numtheory.h"
+#include "sort.h"
+#include "stream.h"
+
 #define Mod 10000
 
 typedef struct {
     long arr[100][100];
 } Matrix;
 
-typedef struct {
-    double arr[1000];
-} double_array;
-
-/**
- * @brief Returns the fibonacci number given by index, reset will
- *        reset n-1 and n-2
- */
-static uint64_t calculateFibonacci(uint8_t index, bool reset)
-{
-    /** initialise variables */
-    static uint64_t fibNumber = 0;
-    static uint64_t first     = 0;
-    static uint64_t second    = 1;
-
-    /** reset the variables since they are static */
-    if (reset)
-    {
-        uint64_t fibNumber = 0;
-        uint64_t first     = 0;
-        uint64_t second    = 1;
-    }
-
-    /** verify input is valid */
-    if (index > UPPER_LIMIT)
-    {
-        fibNumber = 0;
-        return fibNumber;
-    }
-
-    /** 0 or 1 return themselves */
-    if (index <= 1)
-    {
-        fibNumber = index;
-    }
-
-    /** calculate the number (n-1 + n-2) */
-    else
-    {
-        fibNumber = first + second;
-        first  = second;
-        second = fibNumber;
-    }
-
-    return fibNumber;
-}
-
-/**
- * @brief Returns true if the given number is a prime number
- *        greater than 1
- */
-static bool isPrime(uint64_t toCheck)
-{
-    /** 0 or 1 does not count */
-    if (toCheck <= 1)
-    {
-        return false;
-    }
-
-    /** any event number cannot be prime */
-    if (toCheck % 2 == 0)
-    {
-        return false;
-    }
-
-    /** only need to check half the points */
-    uint64_t upperLimit = toCheck / 2;
-
-    for (uint64_t i = 3; i < upperLimit; i += 2)
-    {
-        if (toCheck % i == 0)
-        {
-            return false;
-        }
-    }
-
-    return true;
-}
-
-double_array fpeak(double_array a, double_array b)
-{
-    int arr_len = sizeof(a.arr)/sizeof(a.arr[0]);
-    double_array sum;
-    memset(sum.arr, 0, sizeof(sum.arr));
-    for(int i = 0; i < arr_len; i++) {
-        sum.arr[i] = a.arr[i] + b.arr[i];
-    }
-    return sum;
-}
-
 /*multiply the two matrices*/
 static Matrix mMulti(Matrix a, Matrix b)
 {
@@ -126,6 +51,9 @@ Matrix mPow(Matrix a, int k)
     Matrix modd,meven;
 
     meven=a;                             //matrix meven is initialized
+    memset(modd.arr,0,sizeof(modd.arr)); //matrix modd starts as the identity
+    for(int i=0; i<100; i++)
+        modd.arr[i][i]=1;
 
     if(k==0)
         return modd;
@@ -190,307 +118,1034 @@ void stringsort()
 
 }
 
-typedef struct _Range {
-    int start, end;
-} Range;
+int conf[10]; /* Element conf[d] gives the current position of disk d. */
+
+void move(int d, int t) {
+    /* move disk d to peg t */
+    conf[d] = t;
+}
+
+void hanoi(int h, int t) {
+    if (h > 0) {
+        int f = conf[h-1];
+        if (f != t) {
+            int r = 3 - f - t ;
+            hanoi(h-1, r);
+            move(h-1, t);
+        }
+        hanoi(h-1, t);
+    }
+}
+
+/*
+ * The load driver. It runs one of the kernels above in a loop on one or more
+ * threads, for a number of iterations or a length of time, and prints when the
+ * phase started and ended, timestamped like rp_t2's samples so that the phase
+ * can be matched up with the rows of a CSV recorded while it ran.
+ *
+ * The threads can be pinned to CPUs, and kept busy for only part of each
+ * period, with the duty stepped or ramped over the phase. Each thread's rate
+ * and busy time are printed every second or so, which with rp_t2's CSV gives
+ * the power at each utilization from a single run.
+ */
+
+static const char* gArgv0 = "load";
+
+static void
+Abort(const char* aFormat, ...)
+{
+    va_list vargs;
+    va_start(vargs, aFormat);
+    fprintf(stderr, "%s: ", gArgv0);
+    vfprintf(stderr, aFormat, vargs);
+    fprintf(stderr, "\n");
+    va_end(vargs);
 
-Range new_Range(int s, int e) {
-    Range r;
-    r.start = s;
-    r.end = e;
-    return r;
+    exit(1);
 }
-static void swap(int *x, int *y) {
-    int t = *x;
-    *x = *y;
-    *y = t;
+
+static int64_t
+MonotonicNow_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
 }
 
-void quick_sort(int arr[], const int len) {
-    if (len <= 0)
-        return; //避免len等於負值時宣告堆疊陣列當機
-    //r[]模擬堆疊,p為數量,r[p++]為push,r[--p]為pop且取得元素
-    Range r[len];
-    int p = 0;
-    r[p++] = new_Range(0, len - 1);
-    while (p) {
-        Range range = r[--p];
-        if (range.start >= range.end)
-            continue;
-        int mid = arr[range.end];
-        int left = range.start, right = range.end - 1;
-        while (left < right) {
-            while (arr[left] < mid && left < right)
-                left++;
-            while (arr[right] >= mid && left < right)
-                right--;
-            swap(&arr[left], &arr[right]);
+// The inputs come from this xorshift64* generator rather than rand(), so that
+// they only depend on --seed and the thread, and threads don't contend on it.
+static uint32_t
+NextRandom(uint64_t& aState)
+{
+    aState ^= aState >> 12;
+    aState ^= aState << 25;
+    aState ^= aState >> 27;
+    return uint32_t((aState * 2685821657736338717ULL) >> 32);
+}
+
+// Each thread has its own inputs and buffers, which the kernel's setup
+// function allocates and fills in once, before the phase starts.
+struct KernelState
+{
+    long mSize;
+    uint64_t mRandom;
+    void* mInput;
+    void* mWork;
+    void* mOutput;
+};
+
+struct Kernel
+{
+    const char* mName;
+    const char* mSizeMeaning;
+    long mDefaultSize;
+    long mMaxSize;
+    void (*mSetup)(KernelState& aState);
+    // Runs one iteration and returns a checksum of its results, so that the
+    // compiler can't drop the work.
+    uint64_t (*mRun)(KernelState& aState);
+    // The bytes an iteration moves and the floating-point operations it does,
+    // per unit of its size, for the kernels whose bandwidth is reported.
+    double mBytesPerUnit;
+    double mFlopsPerUnit;
+};
+
+static void
+SetupNothing(KernelState& aState)
+{
+}
+
+// The kind of input the sort kernels get, from --input.
+static SortInput gSortInput = kRandomInput;
+
+static void
+SetupInts(KernelState& aState)
+{
+    int* input = new int[aState.mSize];
+    MakeSortInput(input, aState.mSize, gSortInput, aState.mRandom);
+    aState.mInput = input;
+    aState.mWork = new int[aState.mSize];
+    aState.mOutput = new int[aState.mSize];
+}
+
+static uint64_t
+RunIdle(KernelState& aState)
+{
+    struct timespec ts;
+    ts.tv_sec = aState.mSize / 1000;
+    ts.tv_nsec = (aState.mSize % 1000) * 1000000;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+    return 0;
+}
+
+static uint64_t
+RunFibonacci(KernelState& aState)
+{
+    // calculateFibonacci() isn't thread-safe, so this uses Fibonacci().
+    uint64_t sum = 0;
+    for (long i = 0; i < aState.mSize; i++) {
+        sum += Fibonacci(i % (kMaxFibonacciIndex + 1));
+    }
+    return sum;
+}
+
+static uint64_t
+RunPrime(KernelState& aState)
+{
+    uint64_t count = 0;
+    for (long i = 0; i < aState.mSize; i++) {
+        count += isPrime(i);
+    }
+    return count;
+}
+
+static uint64_t
+RunSieve(KernelState& aState)
+{
+    return CountPrimes(0, aState.mSize, 1);
+}
+
+// Tests odd 64-bit numbers from a random one with the top bit set.
+static uint64_t
+RunMillerRabin(KernelState& aState)
+{
+    uint64_t start = (uint64_t(NextRandom(aState.mRandom)) << 32 |
+                      NextRandom(aState.mRandom)) | (1ULL << 63) | 1;
+    uint64_t count = 0;
+    for (long i = 0; i < aState.mSize; i++) {
+        count += IsPrime64(start + 2 * uint64_t(i));
+    }
+    return count;
+}
+
+static void
+SetupFpeak(KernelState& aState)
+{
+    double_array* input = new double_array[2];
+    for (int i = 0; i < 2; i++) {
+        for (size_t j = 0; j < sizeof(input[i].arr) / sizeof(input[i].arr[0]); j++) {
+            input[i].arr[j] = NextRandom(aState.mRandom) / 65536.0;
         }
-        if (arr[left] >= arr[range.end])
-            swap(&arr[left], &arr[range.end]);
-        else
-            left++;
-        r[p++] = new_Range(range.start, left - 1);
-        r[p++] = new_Range(left + 1, range.end);
-    }
-}
-
-void bubble_sort(int arr[], int len) {
-    int i, j, temp;
-    for (i = 0; i < len - 1; i++)
-        for (j = 0; j < len - 1 - i; j++)
-            if (arr[j] > arr[j + 1]) {
-                temp = arr[j];
-                arr[j] = arr[j + 1];
-                arr[j + 1] = temp;
-            }
+    }
+    aState.mInput = input;
 }
 
-static void max_heapify(int arr[], int start, int end) {
-    //建立父節點指標和子節點指標
-    int dad = start;
-    int son = dad * 2 + 1;
-    while (son <= end) { //若子節點指標在範圍內才做比較
-        if (son + 1 <= end && arr[son] < arr[son + 1]) //先比較兩個子節點大小，選擇最大的
-            son++;
-        if (arr[dad] > arr[son]) //如果父節點大於子節點代表調整完畢，直接跳出函數
-            return;
-        else { //否則交換父子內容再繼續子節點和孫節點比較
-            swap(&arr[dad], &arr[son]);
-            dad = son;
-            son = dad * 2 + 1;
+static uint64_t
+RunFpeak(KernelState& aState)
+{
+    double_array* input = (double_array*)aState.mInput;
+    double sum = 0;
+    for (long i = 0; i < aState.mSize; i++) {
+        sum += fpeak(input[0], input[1]).arr[i % 1000];
+    }
+    return uint64_t(sum);
+}
+
+static void
+SetupMatrix(KernelState& aState)
+{
+    Matrix* input = new Matrix[2];
+    for (int m = 0; m < 2; m++) {
+        for (int i = 0; i < 100; i++) {
+            for (int j = 0; j < 100; j++) {
+                input[m].arr[i][j] = NextRandom(aState.mRandom) % Mod;
+            }
         }
     }
+    aState.mInput = input;
 }
 
-void heap_sort(int arr[], int len) {
-    int i;
-    //初始化，i從最後一個父節點開始調整
-    for (i = len / 2 - 1; i >= 0; i--)
-        max_heapify(arr, i, len - 1);
-    //先將第一個元素和已排好元素前一位做交換，再從新調整，直到排序完畢
-    for (i = len - 1; i > 0; i--) {
-        swap(&arr[0], &arr[i]);
-        max_heapify(arr, 0, i - 1);
+static uint64_t
+RunMatrix(KernelState& aState)
+{
+    Matrix* input = (Matrix*)aState.mInput;
+    Matrix product = input[0];
+    for (long i = 0; i < aState.mSize; i++) {
+        product = mMulti(product, input[1]);
     }
+    return product.arr[0][0];
 }
 
-/*复数的定义*/
-typedef struct
+// The blocked modular multiply, for N x N matrices with load.cpp's modulus.
+static void
+SetupMatMul(KernelState& aState)
 {
-    double re;
-    double im;
-} COMPLEX;
-/*复数的加运算*/
-COMPLEX Add(COMPLEX c1, COMPLEX c2)
+    size_t entries = size_t(aState.mSize) * aState.mSize;
+    uint32_t* input = new uint32_t[2 * entries];
+    for (size_t i = 0; i < 2 * entries; i++) {
+        input[i] = NextRandom(aState.mRandom) % Mod;
+    }
+    aState.mInput = input;
+    aState.mWork = new ModMatMul(aState.mSize, Mod);
+    aState.mOutput = new uint32_t[entries];
+    memcpy(aState.mOutput, input, entries * sizeof(uint32_t));
+}
+
+static uint64_t
+RunMatMul(KernelState& aState)
 {
-    COMPLEX c;
-    c.re = c1.re + c2.re;
-    c.im = c1.im + c2.im;
-    return c;
+    uint32_t* input = (uint32_t*)aState.mInput;
+    uint32_t* product = (uint32_t*)aState.mOutput;
+    ModMatMul* matmul = (ModMatMul*)aState.mWork;
+    matmul->Multiply(product, input + aState.mSize * aState.mSize, product);
+    return product[0];
 }
-/*负数的减运算*/
-COMPLEX Sub(COMPLEX c1, COMPLEX c2)
+
+static uint64_t
+RunPi(KernelState& aState)
 {
-    COMPLEX c;
-    c.re = c1.re - c2.re;
-    c.im = c1.im - c2.im;
-    return c;
+    double sum = 0;
+    for (long i = 0; i < aState.mSize; i++) {
+        sum += pi();
+    }
+    return uint64_t(sum);
 }
-/*复数的乘运算*/
-COMPLEX Mul(COMPLEX c1, COMPLEX c2)
+
+static uint64_t
+RunQuickSort(KernelState& aState)
 {
-    COMPLEX c;
-    c.re = c1.re*c2.re - c1.im*c2.im;
-    c.im = c1.re*c2.im + c1.im*c2.re;
-    return c;
+    int* work = (int*)aState.mWork;
+    memcpy(work, aState.mInput, aState.mSize * sizeof(int));
+    quick_sort(work, aState.mSize);
+    return work[aState.mSize / 2];
 }
 
-/*快速傅立叶变换
-TD为时域值，FD为频域值，power为2的幂数*/
-void FFT(COMPLEX *TD, COMPLEX *FD, int power)
+static uint64_t
+RunHeapSort(KernelState& aState)
 {
-    int count;
-    int i,j,k,bfsize,p;
-    double angle;
-    COMPLEX *W,*X1,*X2,*X;
-    /*计算傅立叶变换点数*/
-    count=1<<power;
-    /*分配运算器所需存储器*/
-    W=(COMPLEX *)malloc(sizeof(COMPLEX)*count/2);
-    X1=(COMPLEX *)malloc(sizeof(COMPLEX)*count);
-    X2=(COMPLEX *)malloc(sizeof(COMPLEX)*count);
-    /*计算加权系数*/
-    for(i=0; i<count/2; i++)
-    {
-        angle = -i * 3.14159265359 * 2 / count;
-        W[i].re=cos(angle);
-        W[i].im=sin(angle);
-    }
-    /*将时域点写入存储器*/
-    memcpy(X1, TD, sizeof(COMPLEX)*count);
-    /*蝶形运算*/
-    for(k=0; k<power; k++)
-    {
-        for(j=0; j<1<<k; j++)
-        {
-            bfsize=1<<power-k;
-            for(i=0; i<bfsize/2; i++)
-            {
-                p=j*bfsize;
-                X2[i+p]=Add(X1[i+p], X1[i+p+bfsize/2]);
-                X2[i+p+bfsize/2]=Mul(Sub(X1[i+p], X1[i+p+bfsize/2]),W[i*(1<<k)]);
+    int* work = (int*)aState.mWork;
+    memcpy(work, aState.mInput, aState.mSize * sizeof(int));
+    heap_sort(work, aState.mSize);
+    return work[aState.mSize / 2];
+}
+
+static uint64_t
+RunBubbleSort(KernelState& aState)
+{
+    int* work = (int*)aState.mWork;
+    memcpy(work, aState.mInput, aState.mSize * sizeof(int));
+    bubble_sort(work, aState.mSize);
+    return work[aState.mSize / 2];
+}
+
+static uint64_t
+RunIntroSort(KernelState& aState)
+{
+    int* work = (int*)aState.mWork;
+    memcpy(work, aState.mInput, aState.mSize * sizeof(int));
+    IntroSort(work, aState.mSize);
+    return work[aState.mSize / 2];
+}
+
+static uint64_t
+RunRadixSort(KernelState& aState)
+{
+    int* work = (int*)aState.mWork;
+    memcpy(work, aState.mInput, aState.mSize * sizeof(int));
+    RadixSort(work, aState.mSize, (int*)aState.mOutput);
+    return work[aState.mSize / 2];
+}
+
+// This sorts on every CPU by itself, so it is meant for --threads=1.
+static uint64_t
+RunSampleSort(KernelState& aState)
+{
+    int* work = (int*)aState.mWork;
+    memcpy(work, aState.mInput, aState.mSize * sizeof(int));
+    SampleSort(work, aState.mSize, int(sysconf(_SC_NPROCESSORS_ONLN)));
+    return work[aState.mSize / 2];
+}
+
+static void
+SetupFFT(KernelState& aState)
+{
+    long count = 1L << aState.mSize;
+    COMPLEX* input = new COMPLEX[count];
+    for (long i = 0; i < count; i++) {
+        input[i].re = NextRandom(aState.mRandom) / 4294967296.0;
+        input[i].im = 0;
+    }
+    aState.mInput = input;
+    aState.mWork = new COMPLEX[count];
+    aState.mOutput = new COMPLEX[count];
+}
+
+static uint64_t
+RunFFT(KernelState& aState)
+{
+    COMPLEX* freq = (COMPLEX*)aState.mWork;
+    COMPLEX* time = (COMPLEX*)aState.mOutput;
+    FFT((COMPLEX*)aState.mInput, freq, aState.mSize);
+    IFFT(freq, time, aState.mSize);
+    return uint64_t(time[1].re * 1e9);
+}
+
+// The planned transform, in place on separate real and imaginary arrays.
+static void
+SetupFFTPlan(KernelState& aState)
+{
+    long count = 1L << aState.mSize;
+    double* data = new double[2 * count];
+    for (long i = 0; i < count; i++) {
+        data[i] = NextRandom(aState.mRandom) / 4294967296.0;
+        data[count + i] = 0;
+    }
+    aState.mInput = new FFTPlan(aState.mSize);
+    aState.mWork = data;
+}
+
+static uint64_t
+RunFFTPlan(KernelState& aState)
+{
+    FFTPlan* plan = (FFTPlan*)aState.mInput;
+    double* re = (double*)aState.mWork;
+    double* im = re + plan->Count();
+    plan->Forward(re, im);
+    plan->Inverse(re, im);
+    return uint64_t(re[1] * 1e9);
+}
+
+static void
+SetupBytes(KernelState& aState)
+{
+    unsigned char* input = new unsigned char[aState.mSize];
+    for (long i = 0; i < aState.mSize; i++) {
+        input[i] = (unsigned char)NextRandom(aState.mRandom);
+    }
+    aState.mInput = input;
+}
+
+static uint64_t
+RunCrc32(KernelState& aState)
+{
+    return crc32((const unsigned char*)aState.mInput, aState.mSize);
+}
+
+// The fastest CRC the CPU supports, over a buffer bigger than the caches, to
+// load the memory subsystem.
+static uint64_t
+RunCrc32Fast(KernelState& aState)
+{
+    return Crc32::Compute(aState.mInput, aState.mSize);
+}
+
+static void
+SetupStream(KernelState& aState)
+{
+    aState.mWork = new Stream(aState.mSize, 1);
+}
+
+// A round of STREAM's four ops, which leaves the values where they were.
+static uint64_t
+RunStream(KernelState& aState)
+{
+    Stream* stream = (Stream*)aState.mWork;
+    for (int op = 0; op < kNumStreamOps; op++) {
+        stream->Run(StreamOp(op));
+    }
+    uint64_t bits;
+    memcpy(&bits, stream->A(), sizeof(bits));
+    return bits;
+}
+
+// hanoi() keeps its pegs in the global |conf|, so with more than one thread
+// the moves race, though each call still does the same amount of work.
+static uint64_t
+RunHanoi(KernelState& aState)
+{
+    memset(conf, 0, sizeof(conf));
+    hanoi(aState.mSize, 2);
+    return conf[0];
+}
+
+static const Kernel kKernels[] = {
+    { "idle",       "milliseconds to sleep",     100,     1000000,  SetupNothing, RunIdle },
+    { "fibonacci",  "numbers",                   100000,  0,        SetupNothing, RunFibonacci },
+    { "prime",      "numbers to test",           20000,   0,        SetupNothing, RunPrime },
+    { "sieve",      "the upper bound",           10000000, 1LL << 40, SetupNothing, RunSieve },
+    { "miller-rabin", "numbers to test",         100000,  0,        SetupNothing, RunMillerRabin },
+    { "fpeak",      "1000-element additions",    10000,   0,        SetupFpeak,   RunFpeak },
+    { "matrix",     "100x100 multiplications",   10,      0,        SetupMatrix,  RunMatrix },
+    { "matmul",     "N of the N x N matrices",   256,     8192,     SetupMatMul,  RunMatMul },
+    { "pi",         "10000-term series",         1000,    0,        SetupNothing, RunPi },
+    { "quicksort",  "ints",                      100000,  0,        SetupInts,    RunQuickSort },
+    { "heapsort",   "ints",                      100000,  0,        SetupInts,    RunHeapSort },
+    { "bubblesort", "ints",                      5000,    0,        SetupInts,    RunBubbleSort },
+    { "introsort",  "ints",                      1000000, 0,        SetupInts,    RunIntroSort },
+    { "radixsort",  "ints",                      1000000, 0,        SetupInts,    RunRadixSort },
+    { "samplesort", "ints",                      1000000, 0,        SetupInts,    RunSampleSort },
+    { "fft",        "log2 of the points",        16,      24,       SetupFFT,     RunFFT },
+    { "fft-plan",   "log2 of the points",        16,      26,       SetupFFTPlan, RunFFTPlan },
+    { "crc32",      "bytes",                     1 << 20, 0,        SetupBytes,   RunCrc32 },
+    { "crc32-fast", "bytes",                     1 << 26, 0,        SetupBytes,   RunCrc32Fast },
+    { "stream",     "doubles in each array",     1 << 20, 1L << 30, SetupStream,  RunStream, 80, 4 },
+    { "hanoi",      "disks",                     10,      10,       SetupNothing, RunHanoi },
+};
+static const int kNumKernels = sizeof(kKernels) / sizeof(kKernels[0]);
+
+// How busy each thread is over the phase, as the fraction of each period that
+// it runs the kernel for. A constant duty is a profile of one step.
+enum ProfileKind
+{
+    kStepProfile,                   // mDuty[i] for each mStep_ns in turn.
+    kRampProfile                    // From mDuty[0] to mDuty[1] over the phase.
+};
+
+static const int kMaxSteps = 64;
+
+struct Profile
+{
+    ProfileKind mKind;
+    int mNumSteps;
+    double mDuty[kMaxSteps];
+    int64_t mStep_ns;
+    int64_t mLength_ns;             // The phase's length, for ramps.
+};
+
+static double
+DutyAt(const Profile& aProfile, int64_t aElapsed_ns)
+{
+    if (aProfile.mKind == kRampProfile) {
+        double progress = double(aElapsed_ns) / aProfile.mLength_ns;
+        if (progress > 1) {
+            progress = 1;
+        }
+        return aProfile.mDuty[0] +
+               (aProfile.mDuty[1] - aProfile.mDuty[0]) * progress;
+    }
+    // The last step lasts until the phase ends.
+    int64_t step = aElapsed_ns / aProfile.mStep_ns;
+    if (step >= aProfile.mNumSteps) {
+        step = aProfile.mNumSteps - 1;
+    }
+    return aProfile.mDuty[step];
+}
+
+// Parses a percentage from |aStr| into a fraction, and returns where it ended.
+static const char*
+ParseDuty(const char* aStr, double* aDuty)
+{
+    char* end;
+    double percent = strtod(aStr, &end);
+    if (end == aStr || percent < 0 || percent > 100) {
+        Abort("duties must be percentages from 0 to 100");
+    }
+    *aDuty = percent / 100;
+    return end;
+}
+
+// Parses a list of CPUs like "0-3,8,10-11" into |aCpus|, and returns how many
+// there were.
+static int
+ParseCpuList(const char* aList, int* aCpus)
+{
+    int n = 0;
+    const char* p = aList;
+    for (;;) {
+        char* end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p) {
+            Abort("bad CPU list '%s'", aList);
+        }
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p) {
+                Abort("bad CPU list '%s'", aList);
             }
         }
-        X=X1;
-        X1=X2;
-        X2=X;
+        if (first < 0 || last < first || last >= CPU_SETSIZE) {
+            Abort("bad CPU range %ld-%ld in '%s'", first, last, aList);
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (n == CPU_SETSIZE) {
+                Abort("too many CPUs in '%s'", aList);
+            }
+            aCpus[n++] = int(cpu);
+        }
+        if (*end == '\0') {
+            return n;
+        }
+        if (*end != ',') {
+            Abort("bad CPU list '%s'", aList);
+        }
+        p = end + 1;
     }
-    /*重新排序*/
-    for(j=0; j<count; j++)
-    {
-        p=0;
-        for(i=0; i<power; i++)
-        {
-            if(j&(1<<i))
-                p+=1<<power-i-1;
+}
+
+// The workers wait here twice: once they have set up their kernels, and again
+// while main() takes the start time.
+static pthread_barrier_t gStartBarrier;
+static int64_t gStart_ns;
+static int64_t gDeadline_ns;        // 0 for no limit.
+
+// main() waits on this for the next report, or for the last worker to finish.
+static pthread_mutex_t gDoneLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gDoneCond;
+static int gRunning;
+
+struct Worker
+{
+    pthread_t mThread;
+    int mIndex;
+    int mPinnedCpu;                 // -1 if the thread isn't pinned.
+    const Kernel* mKernel;
+    KernelState mState;
+    const Profile* mProfile;
+    int64_t mPeriod_ns;
+    long mMaxIterations;            // 0 for no limit.
+    // These are read by main() while the thread runs, with __atomic_load_n().
+    long mIterations;
+    int64_t mBusy_ns;               // Time spent in the kernel.
+    int mCpu;                       // The CPU the thread last ran on.
+    uint64_t mChecksum;
+};
+
+static void*
+RunWorker(void* aArg)
+{
+    Worker* worker = (Worker*)aArg;
+    if (worker->mPinnedCpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(worker->mPinnedCpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) {
+            Abort("can't pin thread %d to CPU %d: %s", worker->mIndex,
+                  worker->mPinnedCpu, strerror(err));
         }
-        FD[j]=X1[p];
-    }
-    /*释放存储器*/
-    free(W);
-    free(X1);
-    free(X2);
-}
-
-/*快速傅立叶反变换，利用快速傅立叶变换
-FD为频域值，TD为时域值，power为2的幂数*/
-void IFFT(COMPLEX *FD, COMPLEX *TD, int power)
-{
-    int i,count;
-    COMPLEX *x;
-    /*计算傅立叶反变换点数*/
-    count=1<<power;
-    /*分配运算所需存储器*/
-    x=(COMPLEX *)malloc(sizeof(COMPLEX)*count);
-    /*将频域点写入存储器*/
-    memcpy(x,FD,sizeof(COMPLEX)*count);
-    /*求频域点的共轭*/
-    for(i=0; i<count; i++)
-    {
-        x[i].im=-x[i].im;
     }
-    /*调用快速傅立叶变换*/
-    FFT(x,TD,power);
-    /*求时域点的共轭*/
-    for(i=0; i<count; i++)
-    {
-        TD[i].re/=count;
-        TD[i].im=-TD[i].im/count;
+    // Set up after pinning, so that the buffers are local to the CPU.
+    worker->mKernel->mSetup(worker->mState);
+    pthread_barrier_wait(&gStartBarrier);
+    pthread_barrier_wait(&gStartBarrier);
+
+    // Each period starts with the kernel running until its share of the
+    // period is used, and the rest of it is slept. An iteration isn't cut
+    // short, so the kernel's size limits how finely the duty can be kept.
+    long iterations = 0;
+    int64_t busy_ns = 0;
+    int64_t periodStart_ns = gStart_ns;
+    bool done = false;
+    while (!done) {
+        int64_t now_ns = MonotonicNow_ns();
+        double duty = DutyAt(*worker->mProfile, now_ns - gStart_ns);
+        int64_t periodEnd_ns = periodStart_ns + worker->mPeriod_ns;
+        int64_t busyEnd_ns = periodStart_ns + int64_t(duty * worker->mPeriod_ns);
+        int64_t busyStart_ns = now_ns;
+        while (now_ns < busyEnd_ns) {
+            worker->mChecksum += worker->mKernel->mRun(worker->mState);
+            iterations++;
+            now_ns = MonotonicNow_ns();
+            __atomic_store_n(&worker->mIterations, iterations, __ATOMIC_RELAXED);
+            __atomic_store_n(&worker->mBusy_ns, busy_ns + now_ns - busyStart_ns,
+                             __ATOMIC_RELAXED);
+            if ((worker->mMaxIterations > 0 &&
+                 iterations >= worker->mMaxIterations) ||
+                (gDeadline_ns > 0 && now_ns >= gDeadline_ns)) {
+                done = true;
+                break;
+            }
+        }
+        busy_ns += now_ns - busyStart_ns;
+        __atomic_store_n(&worker->mCpu, sched_getcpu(), __ATOMIC_RELAXED);
+
+        // The period the deadline falls in is cut short there, but its idle
+        // part is still slept, so that the phase ends when it was asked to.
+        bool last = false;
+        if (gDeadline_ns > 0 && periodEnd_ns >= gDeadline_ns) {
+            periodEnd_ns = gDeadline_ns;
+            last = true;
+        }
+        if (!done && now_ns < periodEnd_ns) {
+            struct timespec ts;
+            ts.tv_sec = periodEnd_ns / 1000000000;
+            ts.tv_nsec = periodEnd_ns % 1000000000;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+                   EINTR) {
+            }
+        }
+        done = done || last;
+        // If an iteration ran over the end of the period, start the next one
+        // now rather than running flat out to catch up.
+        periodStart_ns = periodEnd_ns;
+        if (now_ns > periodEnd_ns) {
+            periodStart_ns = now_ns;
+        }
     }
-    /*释放存储器*/
-    free(x);
+
+    pthread_mutex_lock(&gDoneLock);
+    gRunning--;
+    pthread_cond_signal(&gDoneCond);
+    pthread_mutex_unlock(&gDoneLock);
+    return NULL;
 }
 
-int conf[10]; /* Element conf[d] gives the current position of disk d. */
+// Prints the wall-clock time in the same format as rp_t2's timestamp column.
+static void
+PrintTimestamp(FILE* aOut)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    time_t time_sec = tv.tv_sec;
+    struct tm* pt = localtime(&time_sec);
+    fprintf(aOut, "%d:%d:%d.%d", pt->tm_hour, pt->tm_min, pt->tm_sec,
+            int(tv.tv_usec / 1000));
+}
 
-void move(int d, int t) {
-    /* move disk d to peg t */
-    conf[d] = t;
+// Prints the bandwidth and FLOP rate of |aIterations| iterations in
+// |aSeconds|, or empty columns if the kernel doesn't count them.
+static void
+PrintBandwidth(const Kernel* aKernel, long aSize, long aIterations,
+               double aSeconds)
+{
+    if (aKernel->mBytesPerUnit == 0 || aSeconds <= 0) {
+        printf(",,");
+        return;
+    }
+    double units = double(aSize) * aIterations;
+    printf(",%.3f,%.3f", units * aKernel->mBytesPerUnit / aSeconds / 1e9,
+           units * aKernel->mFlopsPerUnit / aSeconds / 1e9);
 }
 
-void hanoi(int h, int t) {
-    if (h > 0) {
-        int f = conf[h-1];
-        if (f != t) {
-            int r = 3 - f - t ;
-            hanoi(h-1, r);
-            move(h-1, t);
+// Prints a row for each thread with what it did since the last report: its
+// iterations per second, and how much of the time it was busy, against the
+// duty it was asked for. Iterations and busy time are only credited when an
+// iteration ends, so one that straddles two reports lands wholly in the
+// second, and the busy share is clamped to 100%.
+static void
+PrintReport(const char* aLabel, Worker* aWorkers, int aNumThreads,
+            long* aLastIterations, int64_t* aLastBusy_ns, int64_t aFrom_ns,
+            int64_t aTo_ns)
+{
+    double interval_sec = (aTo_ns - aFrom_ns) / 1e9;
+    if (interval_sec <= 0) {
+        return;
+    }
+    for (int i = 0; i < aNumThreads; i++) {
+        Worker& worker = aWorkers[i];
+        long iterations = __atomic_load_n(&worker.mIterations, __ATOMIC_RELAXED);
+        int64_t busy_ns = __atomic_load_n(&worker.mBusy_ns, __ATOMIC_RELAXED);
+        long delta = iterations - aLastIterations[i];
+        int64_t deltaBusy_ns = busy_ns - aLastBusy_ns[i];
+        if (deltaBusy_ns > aTo_ns - aFrom_ns) {
+            deltaBusy_ns = aTo_ns - aFrom_ns;
         }
-        hanoi(h-1, t);
+        double duty =
+            DutyAt(*worker.mProfile, (aFrom_ns + aTo_ns) / 2 - gStart_ns);
+        printf("sample,%s,", aLabel);
+        PrintTimestamp(stdout);
+        printf(",%s,%ld,%d,%ld,%.3f,%d,%d,%.1f,%.1f,%.1f",
+               worker.mKernel->mName, worker.mState.mSize, aNumThreads, delta,
+               interval_sec, i, __atomic_load_n(&worker.mCpu, __ATOMIC_RELAXED),
+               duty * 100, deltaBusy_ns / 1e7 / interval_sec,
+               delta / interval_sec);
+        PrintBandwidth(worker.mKernel, worker.mState.mSize, delta,
+                       interval_sec);
+        printf("\n");
+        aLastIterations[i] = iterations;
+        aLastBusy_ns[i] = busy_ns;
     }
+    fflush(stdout);
 }
 
-/*
-    This polynomial ( 0xEDB88320L) DOES generate the same CRC values as ZMODEM and PKZIP
- */
-#include <stdint.h>
-static const uint32_t crc32tab[] = {
-    0x00000000L, 0x77073096L, 0xee0e612cL, 0x990951baL,
-    0x076dc419L, 0x706af48fL, 0xe963a535L, 0x9e6495a3L,
-    0x0edb8832L, 0x79dcb8a4L, 0xe0d5e91eL, 0x97d2d988L,
-    0x09b64c2bL, 0x7eb17cbdL, 0xe7b82d07L, 0x90bf1d91L,
-    0x1db71064L, 0x6ab020f2L, 0xf3b97148L, 0x84be41deL,
-    0x1adad47dL, 0x6ddde4ebL, 0xf4d4b551L, 0x83d385c7L,
-    0x136c9856L, 0x646ba8c0L, 0xfd62f97aL, 0x8a65c9ecL,
-    0x14015c4fL, 0x63066cd9L, 0xfa0f3d63L, 0x8d080df5L,
-    0x3b6e20c8L, 0x4c69105eL, 0xd56041e4L, 0xa2677172L,
-    0x3c03e4d1L, 0x4b04d447L, 0xd20d85fdL, 0xa50ab56bL,
-    0x35b5a8faL, 0x42b2986cL, 0xdbbbc9d6L, 0xacbcf940L,
-    0x32d86ce3L, 0x45df5c75L, 0xdcd60dcfL, 0xabd13d59L,
-    0x26d930acL, 0x51de003aL, 0xc8d75180L, 0xbfd06116L,
-    0x21b4f4b5L, 0x56b3c423L, 0xcfba9599L, 0xb8bda50fL,
-    0x2802b89eL, 0x5f058808L, 0xc60cd9b2L, 0xb10be924L,
-    0x2f6f7c87L, 0x58684c11L, 0xc1611dabL, 0xb6662d3dL,
-    0x76dc4190L, 0x01db7106L, 0x98d220bcL, 0xefd5102aL,
-    0x71b18589L, 0x06b6b51fL, 0x9fbfe4a5L, 0xe8b8d433L,
-    0x7807c9a2L, 0x0f00f934L, 0x9609a88eL, 0xe10e9818L,
-    0x7f6a0dbbL, 0x086d3d2dL, 0x91646c97L, 0xe6635c01L,
-    0x6b6b51f4L, 0x1c6c6162L, 0x856530d8L, 0xf262004eL,
-    0x6c0695edL, 0x1b01a57bL, 0x8208f4c1L, 0xf50fc457L,
-    0x65b0d9c6L, 0x12b7e950L, 0x8bbeb8eaL, 0xfcb9887cL,
-    0x62dd1ddfL, 0x15da2d49L, 0x8cd37cf3L, 0xfbd44c65L,
-    0x4db26158L, 0x3ab551ceL, 0xa3bc0074L, 0xd4bb30e2L,
-    0x4adfa541L, 0x3dd895d7L, 0xa4d1c46dL, 0xd3d6f4fbL,
-    0x4369e96aL, 0x346ed9fcL, 0xad678846L, 0xda60b8d0L,
-    0x44042d73L, 0x33031de5L, 0xaa0a4c5fL, 0xdd0d7cc9L,
-    0x5005713cL, 0x270241aaL, 0xbe0b1010L, 0xc90c2086L,
-    0x5768b525L, 0x206f85b3L, 0xb966d409L, 0xce61e49fL,
-    0x5edef90eL, 0x29d9c998L, 0xb0d09822L, 0xc7d7a8b4L,
-    0x59b33d17L, 0x2eb40d81L, 0xb7bd5c3bL, 0xc0ba6cadL,
-    0xedb88320L, 0x9abfb3b6L, 0x03b6e20cL, 0x74b1d29aL,
-    0xead54739L, 0x9dd277afL, 0x04db2615L, 0x73dc1683L,
-    0xe3630b12L, 0x94643b84L, 0x0d6d6a3eL, 0x7a6a5aa8L,
-    0xe40ecf0bL, 0x9309ff9dL, 0x0a00ae27L, 0x7d079eb1L,
-    0xf00f9344L, 0x8708a3d2L, 0x1e01f268L, 0x6906c2feL,
-    0xf762575dL, 0x806567cbL, 0x196c3671L, 0x6e6b06e7L,
-    0xfed41b76L, 0x89d32be0L, 0x10da7a5aL, 0x67dd4accL,
-    0xf9b9df6fL, 0x8ebeeff9L, 0x17b7be43L, 0x60b08ed5L,
-    0xd6d6a3e8L, 0xa1d1937eL, 0x38d8c2c4L, 0x4fdff252L,
-    0xd1bb67f1L, 0xa6bc5767L, 0x3fb506ddL, 0x48b2364bL,
-    0xd80d2bdaL, 0xaf0a1b4cL, 0x36034af6L, 0x41047a60L,
-    0xdf60efc3L, 0xa867df55L, 0x316e8eefL, 0x4669be79L,
-    0xcb61b38cL, 0xbc66831aL, 0x256fd2a0L, 0x5268e236L,
-    0xcc0c7795L, 0xbb0b4703L, 0x220216b9L, 0x5505262fL,
-    0xc5ba3bbeL, 0xb2bd0b28L, 0x2bb45a92L, 0x5cb36a04L,
-    0xc2d7ffa7L, 0xb5d0cf31L, 0x2cd99e8bL, 0x5bdeae1dL,
-    0x9b64c2b0L, 0xec63f226L, 0x756aa39cL, 0x026d930aL,
-    0x9c0906a9L, 0xeb0e363fL, 0x72076785L, 0x05005713L,
-    0x95bf4a82L, 0xe2b87a14L, 0x7bb12baeL, 0x0cb61b38L,
-    0x92d28e9bL, 0xe5d5be0dL, 0x7cdcefb7L, 0x0bdbdf21L,
-    0x86d3d2d4L, 0xf1d4e242L, 0x68ddb3f8L, 0x1fda836eL,
-    0x81be16cdL, 0xf6b9265bL, 0x6fb077e1L, 0x18b74777L,
-    0x88085ae6L, 0xff0f6a70L, 0x66063bcaL, 0x11010b5cL,
-    0x8f659effL, 0xf862ae69L, 0x616bffd3L, 0x166ccf45L,
-    0xa00ae278L, 0xd70dd2eeL, 0x4e048354L, 0x3903b3c2L,
-    0xa7672661L, 0xd06016f7L, 0x4969474dL, 0x3e6e77dbL,
-    0xaed16a4aL, 0xd9d65adcL, 0x40df0b66L, 0x37d83bf0L,
-    0xa9bcae53L, 0xdebb9ec5L, 0x47b2cf7fL, 0x30b5ffe9L,
-    0xbdbdf21cL, 0xcabac28aL, 0x53b39330L, 0x24b4a3a6L,
-    0xbad03605L, 0xcdd70693L, 0x54de5729L, 0x23d967bfL,
-    0xb3667a2eL, 0xc4614ab8L, 0x5d681b02L, 0x2a6f2b94L,
-    0xb40bbe37L, 0xc30c8ea1L, 0x5a05df1bL, 0x2d02ef8dL
-};
-
-uint32_t crc32( const unsigned char *buf, uint32_t size)
+static void
+Usage()
 {
-    uint32_t i, crc;
-    crc = 0xFFFFFFFF;
-    for (i = 0; i < size; i++)
-        crc = crc32tab[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
-    return crc^0xFFFFFFFF;
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "\n"
+            "Run a kernel on some threads and print when the phase started\n"
+            "and ended, with the timestamps rp_t2 writes, and what each\n"
+            "thread did every --report seconds in between.\n"
+            "\n"
+            "  --kernel=NAME     the kernel to run (default: %s)\n"
+            "  --size=N          the kernel's problem size\n"
+            "  --iterations=N    stop each thread after N iterations\n"
+            "  --duration=SEC    stop after SEC seconds (default: 10, or the\n"
+            "                    length of the --duty steps, unless\n"
+            "                    --iterations is given)\n"
+            "  --threads=N       run the kernel on N threads (default: 1)\n"
+            "  --cpus=LIST       pin thread i to the i-th CPU of LIST, like\n"
+            "                    0-3,8 (wrapping around if it's short)\n"
+            "  --pin             pin the threads to the CPUs this process may\n"
+            "                    run on, in order\n"
+            "  --duty=PCT[,PCT...]\n"
+            "                    keep the threads busy for PCT%% of each period\n"
+            "                    (default: 100); with several, step through\n"
+            "                    them every --step seconds\n"
+            "  --ramp=FROM-TO    change the duty from FROM%% to TO%% over the\n"
+            "                    phase\n"
+            "  --step=SEC        the length of each --duty step (default: 10)\n"
+            "  --period=MS       the duty cycle's period (default: 100); a\n"
+            "                    kernel iteration should be much shorter\n"
+            "  --report=SEC      print each thread's rate every SEC seconds,\n"
+            "                    or never if 0 (default: 1)\n"
+            "  --label=TEXT      the phase's label (default: the kernel's name)\n"
+            "  --seed=N          seed the kernel's inputs with N (default: 1)\n"
+            "  --input=random|sorted|reversed|duplicates\n"
+            "                    the sort kernels' input (default: random)\n"
+            "  --help            print this message\n"
+            "\n"
+            "kernels:\n",
+            gArgv0, kKernels[1].mName);
+    for (int i = 0; i < kNumKernels; i++) {
+        fprintf(stderr, "  %-11s size is %s (default: %ld)\n", kKernels[i].mName,
+                kKernels[i].mSizeMeaning, kKernels[i].mDefaultSize);
+    }
 }
 
+int
+main(int argc, char** argv)
+{
+    gArgv0 = argv[0];
+
+    static const struct option longOptions[] = {
+        { "kernel",     required_argument, NULL, 'k' },
+        { "size",       required_argument, NULL, 's' },
+        { "iterations", required_argument, NULL, 'n' },
+        { "duration",   required_argument, NULL, 'd' },
+        { "threads",    required_argument, NULL, 't' },
+        { "cpus",       required_argument, NULL, 'c' },
+        { "pin",        no_argument,       NULL, 'P' },
+        { "duty",       required_argument, NULL, 'D' },
+        { "ramp",       required_argument, NULL, 'R' },
+        { "step",       required_argument, NULL, 'T' },
+        { "period",     required_argument, NULL, 'p' },
+        { "report",     required_argument, NULL, 'r' },
+        { "label",      required_argument, NULL, 'l' },
+        { "seed",       required_argument, NULL, 'S' },
+        { "input",      required_argument, NULL, 'I' },
+        { "help",       no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    const Kernel* kernel = &kKernels[1];
+    long size = 0;
+    long iterations = 0;
+    double duration_sec = -1;
+    int numThreads = 1;
+    static int cpus[CPU_SETSIZE];
+    int numCpus = 0;
+    bool pin = false;
+    Profile profile;
+    profile.mKind = kStepProfile;
+    profile.mNumSteps = 1;
+    profile.mDuty[0] = 1;
+    double step_sec = 10;
+    double period_ms = 100;
+    double report_sec = 1;
+    const char* label = NULL;
+    uint64_t seed = 1;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'k':
+            kernel = NULL;
+            for (int i = 0; i < kNumKernels; i++) {
+                if (strcmp(optarg, kKernels[i].mName) == 0) {
+                    kernel = &kKernels[i];
+                }
+            }
+            if (!kernel) {
+                Abort("unknown kernel '%s'", optarg);
+            }
+            break;
+        case 's':
+            size = atol(optarg);
+            if (size < 1) {
+                Abort("--size must be at least 1");
+            }
+            break;
+        case 'n':
+            iterations = atol(optarg);
+            if (iterations < 1) {
+                Abort("--iterations must be at least 1");
+            }
+            break;
+        case 'd':
+            duration_sec = atof(optarg);
+            if (duration_sec <= 0) {
+                Abort("--duration must be positive");
+            }
+            break;
+        case 't':
+            numThreads = atoi(optarg);
+            if (numThreads < 1) {
+                Abort("--threads must be at least 1");
+            }
+            break;
+        case 'c':
+            numCpus = ParseCpuList(optarg, cpus);
+            break;
+        case 'P':
+            pin = true;
+            break;
+        case 'D': {
+            profile.mKind = kStepProfile;
+            profile.mNumSteps = 0;
+            const char* p = optarg;
+            for (;;) {
+                if (profile.mNumSteps == kMaxSteps) {
+                    Abort("--duty can have at most %d steps", kMaxSteps);
+                }
+                p = ParseDuty(p, &profile.mDuty[profile.mNumSteps++]);
+                if (*p == '\0') {
+                    break;
+                }
+                if (*p != ',') {
+                    Abort("bad --duty '%s'", optarg);
+                }
+                p++;
+            }
+            break;
+        }
+        case 'R': {
+            profile.mKind = kRampProfile;
+            profile.mNumSteps = 2;
+            const char* p = ParseDuty(optarg, &profile.mDuty[0]);
+            if (*p != '-' || *ParseDuty(p + 1, &profile.mDuty[1]) != '\0') {
+                Abort("bad --ramp '%s'", optarg);
+            }
+            break;
+        }
+        case 'T':
+            step_sec = atof(optarg);
+            if (step_sec <= 0) {
+                Abort("--step must be positive");
+            }
+            break;
+        case 'p':
+            period_ms = atof(optarg);
+            if (period_ms < 1) {
+                Abort("--period must be at least 1 ms");
+            }
+            break;
+        case 'r':
+            report_sec = atof(optarg);
+            if (report_sec < 0) {
+                Abort("--report can't be negative");
+            }
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'I': {
+            int input = 0;
+            while (input < kNumSortInputs &&
+                   strcmp(optarg, kSortInputNames[input]) != 0) {
+                input++;
+            }
+            if (input == kNumSortInputs) {
+                Abort("unknown input '%s'", optarg);
+            }
+            gSortInput = SortInput(input);
+            break;
+        }
+        case 'h':
+            Usage();
+            exit(0);
+        default:
+            Usage();
+            exit(1);
+        }
+    }
+    if (optind < argc) {
+        Usage();
+        exit(1);
+    }
+    if (size == 0) {
+        size = kernel->mDefaultSize;
+    }
+    if (kernel->mMaxSize > 0 && size > kernel->mMaxSize) {
+        Abort("--size for %s must be at most %ld", kernel->mName,
+              kernel->mMaxSize);
+    }
+    if (duration_sec < 0 && iterations == 0) {
+        duration_sec = profile.mKind == kStepProfile && profile.mNumSteps > 1
+                       ? profile.mNumSteps * step_sec : 10;
+    }
+    if (profile.mKind == kRampProfile && duration_sec < 0) {
+        Abort("--ramp needs --duration");
+    }
+    // The last step's duty holds until --iterations are done, which they
+    // never would be at 0%.
+    if (duration_sec < 0 && profile.mDuty[profile.mNumSteps - 1] <= 0) {
+        Abort("--iterations with a last --duty of 0 needs --duration");
+    }
+    profile.mStep_ns = int64_t(step_sec * 1e9);
+    profile.mLength_ns = int64_t(duration_sec * 1e9);
+    if (pin && numCpus == 0) {
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+            Abort("sched_getaffinity() failed: %s", strerror(errno));
+        }
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus[numCpus++] = cpu;
+            }
+        }
+    }
+    if (!label) {
+        label = kernel->mName;
+    }
+
+    pthread_condattr_t condAttr;
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&gDoneCond, &condAttr);
+    pthread_barrier_init(&gStartBarrier, NULL, numThreads + 1);
+    gRunning = numThreads;
+
+    Worker* workers = new Worker[numThreads];
+    for (int i = 0; i < numThreads; i++) {
+        Worker& worker = workers[i];
+        memset(&worker, 0, sizeof(worker));
+        worker.mIndex = i;
+        worker.mPinnedCpu = numCpus > 0 ? cpus[i % numCpus] : -1;
+        worker.mCpu = -1;
+        worker.mKernel = kernel;
+        worker.mState.mSize = size;
+        // xorshift needs a non-zero state.
+        worker.mState.mRandom = (seed + i) * 0x9E3779B97F4A7C15ULL | 1;
+        worker.mProfile = &profile;
+        worker.mPeriod_ns = int64_t(period_ms * 1e6);
+        worker.mMaxIterations = iterations;
+        int err = pthread_create(&worker.mThread, NULL, RunWorker, &worker);
+        if (err != 0) {
+            Abort("pthread_create() failed: %s", strerror(err));
+        }
+    }
+    pthread_barrier_wait(&gStartBarrier);
+
+    printf("event,label,timestamp,kernel,size,threads,iterations,seconds,"
+           "thread,cpu,duty,busy,ops-per-sec,gb-per-sec,gflop-per-sec\n");
+    printf("start,%s,", label);
+    PrintTimestamp(stdout);
+    printf(",%s,%ld,%d,0,0,,,%.1f,,,,\n", kernel->mName, size, numThreads,
+           DutyAt(profile, 0) * 100);
+    fflush(stdout);
+
+    gStart_ns = MonotonicNow_ns();
+    if (duration_sec > 0) {
+        gDeadline_ns = gStart_ns + int64_t(duration_sec * 1e9);
+    }
+    pthread_barrier_wait(&gStartBarrier);
 
+    long* lastIterations = new long[numThreads]();
+    int64_t* lastBusy_ns = new int64_t[numThreads]();
+    int64_t lastReport_ns = gStart_ns;
+    int64_t report_ns = int64_t(report_sec * 1e9);
+    pthread_mutex_lock(&gDoneLock);
+    while (gRunning > 0) {
+        if (report_ns == 0) {
+            pthread_cond_wait(&gDoneCond, &gDoneLock);
+            continue;
+        }
+        int64_t next_ns = lastReport_ns + report_ns;
+        struct timespec ts;
+        ts.tv_sec = next_ns / 1000000000;
+        ts.tv_nsec = next_ns % 1000000000;
+        if (pthread_cond_timedwait(&gDoneCond, &gDoneLock, &ts) == ETIMEDOUT) {
+            pthread_mutex_unlock(&gDoneLock);
+            PrintReport(label, workers, numThreads, lastIterations, lastBusy_ns,
+                        lastReport_ns, next_ns);
+            lastReport_ns = next_ns;
+            pthread_mutex_lock(&gDoneLock);
+        }
+    }
+    pthread_mutex_unlock(&gDoneLock);
 
+    long total = 0;
+    uint64_t checksum = 0;
+    for (int i = 0; i < numThreads; i++) {
+        pthread_join(workers[i].mThread, NULL);
+        total += workers[i].mIterations;
+        checksum += workers[i].mChecksum;
+    }
+    int64_t end_ns = MonotonicNow_ns();
+    double elapsed_sec = (end_ns - gStart_ns) / 1e9;
+    // The rest of the last interval, so that the sample rows add up, unless
+    // it's so short that the iterations that happened to end in it would make
+    // nonsense of its rates; the end row has the totals anyway.
+    if (report_ns > 0 && end_ns - lastReport_ns >= report_ns / 2) {
+        PrintReport(label, workers, numThreads, lastIterations, lastBusy_ns,
+                    lastReport_ns, end_ns);
+    }
 
+    printf("end,%s,", label);
+    PrintTimestamp(stdout);
+    printf(",%s,%ld,%d,%ld,%.3f,,,,,%.1f", kernel->mName, size, numThreads,
+           total, elapsed_sec, elapsed_sec > 0 ? total / elapsed_sec : 0);
+    PrintBandwidth(kernel, size, total, elapsed_sec);
+    printf("\n");
+    fprintf(stderr, "%s: %ld iterations in %.3f s, %.1f/s (checksum %llx)\n",
+            label, total, elapsed_sec,
+            elapsed_sec > 0 ? total / elapsed_sec : 0,
+            (unsigned long long)checksum);
+    return 0;
+}
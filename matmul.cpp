@@ -0,0 +1,176 @@
+#include "matmul.h"
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MATMUL_HAVE_AVX2 1
+#endif
+
+// The blocks of |aB| that are multiplied at a time. A block of kBlockDepth rows
+// and 16 columns (8 KB) stays in L1 while it is used for every row of |aA|, and
+// a whole block (128 KB) stays in L2 while the columns are swept.
+static const int kBlockDepth = 128;
+static const int kBlockCols = 256;
+
+void
+ModMatMulNaive(const uint32_t* aA, const uint32_t* aB, uint32_t* aC, int aN,
+               uint32_t aMod)
+{
+    for (int i = 0; i < aN; i++) {
+        for (int j = 0; j < aN; j++) {
+            uint64_t sum = 0;
+            for (int k = 0; k < aN; k++) {
+                sum += uint64_t(aA[i * aN + k]) * aB[k * aN + j];
+            }
+            aC[i * aN + j] = uint32_t(sum % aMod);
+        }
+    }
+}
+
+// Adds |aA| * |aB| to |aAccum| a block at a time, without reducing.
+static void
+MultiplyBlocked(const uint32_t* aA, const uint32_t* aB, uint64_t* aAccum,
+                int aN)
+{
+    for (int jj = 0; jj < aN; jj += kBlockCols) {
+        int jEnd = jj + kBlockCols < aN ? jj + kBlockCols : aN;
+        for (int kk = 0; kk < aN; kk += kBlockDepth) {
+            int kEnd = kk + kBlockDepth < aN ? kk + kBlockDepth : aN;
+            for (int i = 0; i < aN; i++) {
+                const uint32_t* a = aA + size_t(i) * aN;
+                uint64_t* accum = aAccum + size_t(i) * aN;
+                for (int k = kk; k < kEnd; k++) {
+                    uint64_t aik = a[k];
+                    const uint32_t* b = aB + size_t(k) * aN;
+                    for (int j = jj; j < jEnd; j++) {
+                        accum[j] += aik * b[j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+#ifdef MATMUL_HAVE_AVX2
+// The same as MultiplyBlocked(), but 16 columns of a row of |aAccum| are kept
+// in four registers of 64-bit lanes while a block's depth is summed into them.
+// _mm256_mul_epu32 multiplies the low 32 bits of each lane, which is exact
+// because the entries are below 2^16.
+__attribute__((target("avx2")))
+static void
+MultiplyBlockedAVX2(const uint32_t* aA, const uint32_t* aB, uint64_t* aAccum,
+                    int aN)
+{
+    for (int jj = 0; jj < aN; jj += kBlockCols) {
+        int jEnd = jj + kBlockCols < aN ? jj + kBlockCols : aN;
+        for (int kk = 0; kk < aN; kk += kBlockDepth) {
+            int kEnd = kk + kBlockDepth < aN ? kk + kBlockDepth : aN;
+            for (int i = 0; i < aN; i++) {
+                const uint32_t* a = aA + size_t(i) * aN;
+                uint64_t* accum = aAccum + size_t(i) * aN;
+                int j = jj;
+                for (; j + 16 <= jEnd; j += 16) {
+                    __m256i c0 = _mm256_loadu_si256((__m256i*)(accum + j));
+                    __m256i c1 = _mm256_loadu_si256((__m256i*)(accum + j + 4));
+                    __m256i c2 = _mm256_loadu_si256((__m256i*)(accum + j + 8));
+                    __m256i c3 = _mm256_loadu_si256((__m256i*)(accum + j + 12));
+                    for (int k = kk; k < kEnd; k++) {
+                        __m256i aik = _mm256_set1_epi64x(a[k]);
+                        const uint32_t* b = aB + size_t(k) * aN + j;
+                        __m256i b0 = _mm256_cvtepu32_epi64(
+                            _mm_loadu_si128((const __m128i*)b));
+                        __m256i b1 = _mm256_cvtepu32_epi64(
+                            _mm_loadu_si128((const __m128i*)(b + 4)));
+                        __m256i b2 = _mm256_cvtepu32_epi64(
+                            _mm_loadu_si128((const __m128i*)(b + 8)));
+                        __m256i b3 = _mm256_cvtepu32_epi64(
+                            _mm_loadu_si128((const __m128i*)(b + 12)));
+                        c0 = _mm256_add_epi64(c0, _mm256_mul_epu32(aik, b0));
+                        c1 = _mm256_add_epi64(c1, _mm256_mul_epu32(aik, b1));
+                        c2 = _mm256_add_epi64(c2, _mm256_mul_epu32(aik, b2));
+                        c3 = _mm256_add_epi64(c3, _mm256_mul_epu32(aik, b3));
+                    }
+                    _mm256_storeu_si256((__m256i*)(accum + j), c0);
+                    _mm256_storeu_si256((__m256i*)(accum + j + 4), c1);
+                    _mm256_storeu_si256((__m256i*)(accum + j + 8), c2);
+                    _mm256_storeu_si256((__m256i*)(accum + j + 12), c3);
+                }
+                // The last few columns, if N isn't a multiple of 16.
+                for (int k = kk; k < kEnd && j < jEnd; k++) {
+                    uint64_t aik = a[k];
+                    const uint32_t* b = aB + size_t(k) * aN;
+                    for (int jt = j; jt < jEnd; jt++) {
+                        accum[jt] += aik * b[jt];
+                    }
+                }
+            }
+        }
+    }
+}
+#endif
+
+ModMatMul::ModMatMul(int aN, uint32_t aMod)
+  : mN(aN), mMod(aMod), mUseAVX2(false)
+{
+    assert(aN > 0);
+    assert(aMod > 0 && aMod <= kMaxMatrixModulus);
+#ifdef MATMUL_HAVE_AVX2
+    mUseAVX2 = __builtin_cpu_supports("avx2");
+#endif
+    size_t entries = size_t(aN) * aN;
+    mAccum = new uint64_t[entries];
+    mSquare = new uint32_t[entries];
+    mProduct = new uint32_t[entries];
+}
+
+ModMatMul::~ModMatMul()
+{
+    delete[] mAccum;
+    delete[] mSquare;
+    delete[] mProduct;
+}
+
+void
+ModMatMul::Multiply(const uint32_t* aA, const uint32_t* aB, uint32_t* aC)
+{
+    size_t entries = size_t(mN) * mN;
+    memset(mAccum, 0, entries * sizeof(mAccum[0]));
+#ifdef MATMUL_HAVE_AVX2
+    if (mUseAVX2) {
+        MultiplyBlockedAVX2(aA, aB, mAccum, mN);
+    } else
+#endif
+    {
+        MultiplyBlocked(aA, aB, mAccum, mN);
+    }
+    // Nothing reads |aA| or |aB| from here on, so |aC| can be either.
+    for (size_t i = 0; i < entries; i++) {
+        aC[i] = uint32_t(mAccum[i] % mMod);
+    }
+}
+
+void
+ModMatMul::Power(const uint32_t* aA, uint64_t aExp, uint32_t* aResult)
+{
+    size_t entries = size_t(mN) * mN;
+    memcpy(mSquare, aA, entries * sizeof(uint32_t));
+    memset(mProduct, 0, entries * sizeof(uint32_t));
+    for (int i = 0; i < mN; i++) {
+        mProduct[i * mN + i] = 1 % mMod;
+    }
+
+    // |mProduct| collects |aA|^(2^b) for each bit b set in |aExp|, and
+    // |mSquare| is squared once per bit.
+    while (aExp > 0) {
+        if (aExp & 1) {
+            Multiply(mProduct, mSquare, mProduct);
+        }
+        aExp >>= 1;
+        if (aExp > 0) {
+            Multiply(mSquare, mSquare, mSquare);
+        }
+    }
+    memcpy(aResult, mProduct, entries * sizeof(uint32_t));
+}
@@ -0,0 +1,48 @@
+#ifndef MATMUL_H
+#define MATMUL_H
+
+#include <stdint.h>
+
+// Modular multiplication and powers of N x N matrices, for a compute-bound
+// load without any floating point. Matrices are row-major arrays of N * N
+// uint32_t entries, each below the modulus.
+//
+// The modulus is limited to 2^16 so that every product fits in 32 bits and the
+// sum of a row's products fits in 64 bits for any N, which lets the SIMD path
+// reduce each entry just once, at the end.
+static const uint32_t kMaxMatrixModulus = 1 << 16;
+
+// The textbook i-j-k loop, kept as the baseline for the benchmark. Like
+// mMulti() in load.cpp, it walks |aB| down its columns.
+void ModMatMulNaive(const uint32_t* aA, const uint32_t* aB, uint32_t* aC,
+                    int aN, uint32_t aMod);
+
+// This class multiplies matrices of one size and modulus, and owns the
+// scratch space that needs. Products are computed in blocks that fit in the
+// cache, with AVX2 when the CPU has it.
+class ModMatMul
+{
+    int mN;
+    uint32_t mMod;
+    bool mUseAVX2;
+    uint64_t* mAccum;               // N * N unreduced sums.
+    uint32_t* mSquare;              // The running square in Power().
+    uint32_t* mProduct;             // A product in Power().
+
+public:
+    ModMatMul(int aN, uint32_t aMod);
+    ~ModMatMul();
+
+    // Turns the AVX2 path off, to compare it with the scalar one.
+    void DisableAVX2() { mUseAVX2 = false; }
+    bool UsesAVX2() const { return mUseAVX2; }
+
+    // Sets |aC| to |aA| * |aB|. |aC| may be either of them.
+    void Multiply(const uint32_t* aA, const uint32_t* aB, uint32_t* aC);
+
+    // Sets |aResult| to |aA| to the power |aExp|, by repeated squaring.
+    // |aResult| may be |aA|.
+    void Power(const uint32_t* aA, uint64_t aExp, uint32_t* aResult);
+};
+
+#endif // MATMUL_H
@@ -0,0 +1,283 @@
+#include "numtheory.h"
+#include "workers.h"
+
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Returns the fibonacci number given by index, reset will
+ *        reset n-1 and n-2
+ */
+uint64_t calculateFibonacci(uint8_t index, bool reset)
+{
+    /** initialise variables */
+    static uint64_t fibNumber = 0;
+    static uint64_t first     = 0;
+    static uint64_t second    = 1;
+
+    /** reset the variables since they are static */
+    if (reset)
+    {
+        fibNumber = 0;
+        first     = 0;
+        second    = 1;
+    }
+
+    /** verify input is valid */
+    if (index > UPPER_LIMIT)
+    {
+        fibNumber = 0;
+        return fibNumber;
+    }
+
+    /** 0 or 1 return themselves */
+    if (index <= 1)
+    {
+        fibNumber = index;
+    }
+
+    /** calculate the number (n-1 + n-2) */
+    else
+    {
+        fibNumber = first + second;
+        first  = second;
+        second = fibNumber;
+    }
+
+    return fibNumber;
+}
+
+/**
+ * @brief Returns true if the given number is a prime number
+ *        greater than 1
+ */
+bool isPrime(uint64_t toCheck)
+{
+    /** 0 or 1 does not count */
+    if (toCheck <= 1)
+    {
+        return false;
+    }
+
+    /** any event number cannot be prime */
+    if (toCheck % 2 == 0)
+    {
+        return false;
+    }
+
+    /** only need to check half the points */
+    uint64_t upperLimit = toCheck / 2;
+
+    for (uint64_t i = 3; i < upperLimit; i += 2)
+    {
+        if (toCheck % i == 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint64_t
+Fibonacci(unsigned aIndex)
+{
+    if (aIndex > kMaxFibonacciIndex) {
+        return 0;
+    }
+
+    // F(2k) = F(k) (2 F(k+1) - F(k)) and F(2k+1) = F(k)^2 + F(k+1)^2, from
+    // the top bit of |aIndex| down. The intermediate values can wrap, but the
+    // result is right modulo 2^64, and it fits.
+    uint64_t a = 0, b = 1;          // F(k), F(k+1)
+    for (int bit = 31; bit >= 0; bit--) {
+        uint64_t c = a * (2 * b - a);
+        uint64_t d = a * a + b * b;
+        if ((aIndex >> bit) & 1) {
+            a = d;
+            b = c + d;
+        } else {
+            a = c;
+            b = d;
+        }
+    }
+    return a;
+}
+
+static inline uint64_t
+MulMod(uint64_t aA, uint64_t aB, uint64_t aMod)
+{
+    return uint64_t((unsigned __int128)aA * aB % aMod);
+}
+
+static uint64_t
+PowMod(uint64_t aBase, uint64_t aExp, uint64_t aMod)
+{
+    uint64_t result = 1;
+    aBase %= aMod;
+    for (; aExp > 0; aExp >>= 1) {
+        if (aExp & 1) {
+            result = MulMod(result, aBase, aMod);
+        }
+        aBase = MulMod(aBase, aBase, aMod);
+    }
+    return result;
+}
+
+bool
+IsPrime64(uint64_t aN)
+{
+    // These bases are enough for every n < 3.3 * 10^24.
+    static const uint64_t kBases[] = {
+        2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37
+    };
+    static const int kNumBases = sizeof(kBases) / sizeof(kBases[0]);
+
+    if (aN < 2) {
+        return false;
+    }
+    for (int i = 0; i < kNumBases; i++) {
+        if (aN % kBases[i] == 0) {
+            return aN == kBases[i];
+        }
+    }
+
+    uint64_t d = aN - 1;
+    int s = 0;
+    while ((d & 1) == 0) {
+        d >>= 1;
+        s++;
+    }
+    for (int i = 0; i < kNumBases; i++) {
+        uint64_t x = PowMod(kBases[i], d, aN);
+        if (x == 1 || x == aN - 1) {
+            continue;
+        }
+        bool composite = true;
+        for (int r = 1; r < s && composite; r++) {
+            x = MulMod(x, x, aN);
+            composite = x != aN - 1;
+        }
+        if (composite) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A segment has a byte per odd number, so it covers twice this many numbers.
+static const size_t kSegmentBytes = 32 * 1024;
+
+struct SieveShared
+{
+    uint64_t mLow;                  // Odd, and at least 3.
+    uint64_t mHigh;
+    const uint32_t* mPrimes;        // The odd primes up to sqrt(mHigh).
+    size_t mNumPrimes;
+    int mNumThreads;
+};
+
+struct SieveWorker
+{
+    SieveShared* mShared;
+    int mIndex;
+    pthread_t mThread;
+    uint64_t mCount;
+};
+
+static void*
+RunSieveWorker(void* aArg)
+{
+    SieveWorker* worker = (SieveWorker*)aArg;
+    const SieveShared* shared = worker->mShared;
+    unsigned char* composite = new unsigned char[kSegmentBytes];
+    uint64_t span = 2 * kSegmentBytes;
+
+    for (uint64_t segLow = shared->mLow + worker->mIndex * span;
+         segLow < shared->mHigh; segLow += shared->mNumThreads * span) {
+        uint64_t segHigh = shared->mHigh - segLow < span ? shared->mHigh
+                                                         : segLow + span;
+        size_t numOdds = size_t((segHigh - segLow + 1) / 2);
+        memset(composite, 0, numOdds);
+        for (size_t i = 0; i < shared->mNumPrimes; i++) {
+            uint64_t p = shared->mPrimes[i];
+            if (p * p >= segHigh) {
+                break;
+            }
+            // The first odd multiple of p in the segment, but not p itself.
+            uint64_t start = (segLow + p - 1) / p * p;
+            if ((start & 1) == 0) {
+                start += p;
+            }
+            if (start < p * p) {
+                start = p * p;
+            }
+            for (uint64_t j = (start - segLow) / 2; j < numOdds; j += p) {
+                composite[j] = 1;
+            }
+        }
+        for (size_t i = 0; i < numOdds; i++) {
+            worker->mCount += !composite[i];
+        }
+    }
+    delete[] composite;
+    return NULL;
+}
+
+uint64_t
+CountPrimes(uint64_t aLow, uint64_t aHigh, int aNumThreads)
+{
+    assert(aHigh <= kMaxSieveHigh);
+    if (aNumThreads < 1) {
+        aNumThreads = 1;
+    }
+    uint64_t count = aLow <= 2 && aHigh > 2 ? 1 : 0;
+    // The sieve only looks at odd numbers from 3.
+    if (aLow < 3) {
+        aLow = 3;
+    }
+    aLow |= 1;
+    if (aLow >= aHigh) {
+        return count;
+    }
+
+    // The base primes, with a plain sieve up to sqrt(aHigh).
+    uint32_t root = uint32_t(sqrt(double(aHigh)));
+    while (uint64_t(root) * root >= aHigh) {
+        root--;
+    }
+    while (uint64_t(root + 1) * (root + 1) < aHigh) {
+        root++;
+    }
+    unsigned char* small = new unsigned char[root + 1]();
+    uint32_t* primes = new uint32_t[root / 2 + 1];
+    size_t numPrimes = 0;
+    for (uint32_t i = 3; i <= root; i += 2) {
+        if (small[i]) {
+            continue;
+        }
+        primes[numPrimes++] = i;
+        for (uint64_t j = uint64_t(i) * i; j <= root; j += 2 * i) {
+            small[j] = 1;
+        }
+    }
+    delete[] small;
+
+    SieveShared shared = { aLow, aHigh, primes, numPrimes, aNumThreads };
+    SieveWorker* workers = new SieveWorker[aNumThreads];
+    for (int i = 0; i < aNumThreads; i++) {
+        workers[i].mShared = &shared;
+        workers[i].mIndex = i;
+        workers[i].mCount = 0;
+    }
+    RunWorkers(workers, aNumThreads, RunSieveWorker, "CountPrimes");
+    for (int i = 0; i < aNumThreads; i++) {
+        count += workers[i].mCount;
+    }
+    delete[] workers;
+    delete[] primes;
+    return count;
+}
@@ -0,0 +1,35 @@
+#ifndef NUMTHEORY_H
+#define NUMTHEORY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define UPPER_LIMIT  92
+
+// The original functions from load.cpp. calculateFibonacci() keeps its state
+// in statics, so it is not thread-safe: it returns successive Fibonacci
+// numbers when called with index 0 (and reset), 1, 2, and so on.
+uint64_t calculateFibonacci(uint8_t index, bool reset);
+bool isPrime(uint64_t toCheck);
+
+// The largest index whose Fibonacci number fits in 64 bits.
+static const unsigned kMaxFibonacciIndex = 93;
+
+// Returns the Fibonacci number |aIndex| by fast doubling, or 0 if it is more
+// than kMaxFibonacciIndex. Unlike calculateFibonacci() it has no state.
+uint64_t Fibonacci(unsigned aIndex);
+
+// Returns whether |aN| is prime, with the Miller-Rabin test on the bases
+// that make it deterministic for every 64-bit number.
+bool IsPrime64(uint64_t aN);
+
+// The largest |aHigh| CountPrimes() takes, which keeps its table of base
+// primes up to sqrt(aHigh) at a few MB.
+static const uint64_t kMaxSieveHigh = 1ULL << 50;
+
+// Counts the primes in [aLow, aHigh) with a segmented Sieve of Eratosthenes
+// on |aNumThreads| threads. Each segment covers the odd numbers of a range and
+// fits in L1, and the threads take every |aNumThreads|th segment.
+uint64_t CountPrimes(uint64_t aLow, uint64_t aHigh, int aNumThreads);
+
+#endif // NUMTHEORY_H
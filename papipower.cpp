@@ -0,0 +1,1088 @@
+#include "papipower.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Errors are reported under the program's name, as rp_t2 reports its own.
+static void
+Abort(const char* aFormat, ...)
+{
+    va_list vargs;
+    va_start(vargs, aFormat);
+    fprintf(stderr, "%s: ", program_invocation_name);
+    vfprintf(stderr, aFormat, vargs);
+    fprintf(stderr, "\n");
+    va_end(vargs);
+
+    exit(1);
+}
+
+//---------------------------------------------------------------------------
+// Linux-specific code
+//---------------------------------------------------------------------------
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+// There is no glibc wrapper for this system call so we provide our own.
+static int
+perf_event_open(struct perf_event_attr* aAttr, pid_t aPid, int aCpu,
+                int aGroupFd, unsigned long aFlags)
+{
+    return syscall(__NR_perf_event_open, aAttr, aPid, aCpu, aGroupFd, aFlags);
+}
+
+const char* gSysfsRoot = "/sys";
+
+// Returns false if the file cannot be opened.
+template <typename T>
+static bool
+ReadValueFromSysfsFile(const char* aPath, const char* aScanfString, T* aOut)
+{
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s/%s", gSysfsRoot, aPath);
+    FILE* sysfp = fopen(filename, "r");
+    if (!sysfp) {
+        return false;
+    }
+    if (fscanf(sysfp, aScanfString, aOut) != 1) {
+        Abort("fscanf() failed on %s", filename);
+    }
+    fclose(sysfp);
+
+    return true;
+}
+
+// Returns false if the file cannot be opened.
+template <typename T>
+static bool
+ReadValueFromPowerFile(const char* aStr1, const char* aStr2, const char* aStr3,
+                       const char* aScanfString, T* aOut)
+{
+    // The filenames going into this buffer are under our control and the longest
+    // one is "bus/event_source/devices/power/events/energy-cores.scale".
+    // So 256 chars is plenty.
+    char filename[256];
+
+    sprintf(filename, "bus/event_source/devices/power/%s%s%s",
+            aStr1, aStr2, aStr3);
+    return ReadValueFromSysfsFile(filename, aScanfString, aOut);
+}
+
+const char* const kDomainNames[kNumDomains] = {
+    "pkg", "cores", "gpu", "ram"
+};
+
+// This class encapsulates a single RAPL domain of one package: its perf event
+// configuration and the tick accounting between samples. The counter itself is
+// read by the Package that owns it.
+class Domain
+{
+    bool mIsSupported;      // Is the domain supported by the processor?
+
+    // These four are only set if |mIsSupported| is true.
+    double mJoulesPerTick;  // How many Joules each tick of the MSR represents.
+    uint64_t mConfig;       // The perf event config for this domain.
+    int mFd;                // The fd through which the MSR is read.
+    uint64_t mPrevTicks;    // The previous sample's MSR value.
+
+public:
+    enum IsOptional { Optional, NonOptional };
+
+    Domain(const char* aName, IsOptional aOptional = NonOptional)
+      : mJoulesPerTick(0), mFd(-1), mPrevTicks(0)
+    {
+        if (!ReadValueFromPowerFile("events/energy-", aName, "", "event=%llx",
+                                    &mConfig)) {
+            // Failure is allowed for optional domains.
+            if (aOptional == NonOptional) {
+                Abort("failed to open file for non-optional domain '%s'\n"
+                      "- Is your kernel version 3.14 or later, as required? "
+                      "Run |uname -r| to see.", aName);
+            }
+            mIsSupported = false;
+            return;
+        }
+
+        mIsSupported = true;
+
+        ReadValueFromPowerFile("events/energy-", aName, ".scale", "%lf",
+                               &mJoulesPerTick);
+
+        // The unit should be "Joules", so 128 chars should be plenty.
+        char unit[128];
+        ReadValueFromPowerFile("events/energy-", aName, ".unit", "%127s", unit);
+        if (strcmp(unit, "Joules") != 0) {
+            Abort("unexpected unit '%s' in .unit file", unit);
+        }
+    }
+
+    ~Domain()
+    {
+        if (mFd >= 0) {
+            close(mFd);
+        }
+    }
+
+    bool IsSupported() const { return mIsSupported; }
+
+    // Returns 0 for an unsupported domain.
+    double JoulesPerTick() const { return mJoulesPerTick; }
+
+    // Opens the domain's counter on |aCpu| as a member of the group led by
+    // |aGroupFd|, or as the group leader if |aGroupFd| is -1. Returns the fd.
+    int Open(uint32_t aType, int aCpu, int aGroupFd)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = aType;
+        attr.size = uint32_t(sizeof(attr));
+        attr.config = mConfig;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED;
+
+        // Measure all processes/threads. RAPL counters are per package, so any
+        // CPU of the package will do.
+        mFd = perf_event_open(&attr, /* pid = */ -1, aCpu, aGroupFd,
+                              /* flags = */ 0);
+        if (mFd < 0) {
+            Abort("perf_event_open() failed\n"
+                  "- Did you run as root (e.g. with |sudo|) or set\n"
+                  "  /proc/sys/kernel/perf_event_paranoid to 0, as required?");
+        }
+        return mFd;
+    }
+
+    // Returns the number of ticks since the previous call.
+    uint64_t TicksSince(uint64_t aThisTicks)
+    {
+        uint64_t ticks = aThisTicks - mPrevTicks;
+        mPrevTicks = aThisTicks;
+        return ticks;
+    }
+};
+
+// This class reads all the supported domains of one package as a single perf
+// event group, so that one read() returns an atomic snapshot of every domain
+// together with the kernel's enabled time for the group.
+class PerfPackage : public Package
+{
+    Domain* mDomains[kNumDomains];
+    int mLeaderFd;
+    int mNumOpen;                   // The number of events in the group.
+    int mSlot[kNumDomains];         // Index in the group read, or -1.
+    uint64_t mPrevEnabled_ns;
+
+public:
+    PerfPackage(uint32_t aType, int aCpu)
+      : mLeaderFd(-1), mNumOpen(0), mPrevEnabled_ns(0)
+    {
+        // pkg is non-optional, so it is always there to lead the group.
+        mDomains[kPkg]   = new Domain(kDomainNames[kPkg]);
+        mDomains[kCores] = new Domain(kDomainNames[kCores]);
+        mDomains[kGpu]   = new Domain(kDomainNames[kGpu], Domain::Optional);
+        mDomains[kRam]   = new Domain(kDomainNames[kRam], Domain::Optional);
+
+        for (int i = 0; i < kNumDomains; i++) {
+            mSlot[i] = -1;
+            if (!mDomains[i]->IsSupported()) {
+                continue;
+            }
+            int fd = mDomains[i]->Open(aType, aCpu, mLeaderFd);
+            if (mLeaderFd < 0) {
+                mLeaderFd = fd;
+            }
+            mSlot[i] = mNumOpen++;
+        }
+    }
+
+    ~PerfPackage()
+    {
+        // Close the group members before the leader.
+        for (int i = kNumDomains - 1; i >= 0; i--) {
+            delete mDomains[i];
+        }
+    }
+
+    virtual double JoulesPerTick(int aDomain) const
+    {
+        return mDomains[aDomain]->JoulesPerTick();
+    }
+
+    virtual void Read(PackageSample& aSample)
+    {
+        // The PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED layout:
+        // { nr, time_enabled, value[nr] }.
+        uint64_t buf[2 + kNumDomains];
+        ssize_t size = sizeof(uint64_t) * (2 + mNumOpen);
+        if (read(mLeaderFd, buf, size) != size || buf[0] != uint64_t(mNumOpen)) {
+            Abort("read() failed");
+        }
+
+        aSample.mWindow_ns = buf[1] - mPrevEnabled_ns;
+        mPrevEnabled_ns = buf[1];
+        for (int i = 0; i < kNumDomains; i++) {
+            aSample.mTicks[i] =
+                mSlot[i] < 0 ? 0 : mDomains[i]->TicksSince(buf[2 + mSlot[i]]);
+        }
+    }
+};
+
+int64_t
+MonotonicNow_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+const char* gCpuInfoPath = "/proc/cpuinfo";
+
+// Reads the vendor, family and model of the CPUs from |gCpuInfoPath|. Every
+// CPU is the same model, so the first one's lines are enough. Returns false if
+// they can't be found, e.g. on other architectures.
+static bool
+ReadCpuModel(char* aVendor, size_t aVendorSize, int* aFamily, int* aModel)
+{
+    FILE* in = fopen(gCpuInfoPath, "r");
+    if (!in) {
+        return false;
+    }
+    char vendor[64] = "";
+    int family = -1, model = -1;
+    char line[256];
+    while ((!vendor[0] || family < 0 || model < 0) &&
+           fgets(line, sizeof(line), in)) {
+        sscanf(line, "vendor_id : %63s", vendor);
+        sscanf(line, "cpu family : %d", &family);
+        sscanf(line, "model : %d", &model);
+    }
+    fclose(in);
+    if (!vendor[0] || family < 0 || model < 0) {
+        return false;
+    }
+    snprintf(aVendor, aVendorSize, "%s", vendor);
+    *aFamily = family;
+    *aModel = model;
+    return true;
+}
+
+// The server parts that count DRAM energy in a fixed unit of 2^-16 J (15.3
+// uJ) instead of the one in MSR_RAPL_POWER_UNIT, as Linux's intel_rapl and
+// perf rapl drivers list them. All are Intel family 6.
+static const int kFixedDramUnitModels[] = {
+    0x3f,   // Haswell-EP
+    0x4f,   // Broadwell-EP
+    0x56,   // Broadwell-DE
+    0x55,   // Skylake-SP, Cascade Lake, Cooper Lake
+    0x57,   // Knights Landing
+    0x85,   // Knights Mill
+    0x6a,   // Ice Lake-SP
+    0x6c,   // Ice Lake-D
+    0x8f,   // Sapphire Rapids
+    0xcf,   // Emerald Rapids
+};
+static const double kFixedDramJoulesPerTick = 1.0 / 65536;
+
+// The RAPL MSRs, from the Intel SDM volume 3, section 14.9.
+static const uint32_t MSR_RAPL_POWER_UNIT   = 0x606;
+static const uint32_t MSR_PKG_ENERGY_STATUS = 0x611;
+static const uint32_t MSR_DRAM_ENERGY_STATUS = 0x619;
+static const uint32_t MSR_PP0_ENERGY_STATUS = 0x639;
+static const uint32_t MSR_PP1_ENERGY_STATUS = 0x641;
+
+// AMD's, from family 17h on, which Hygon's share. The unit MSR has the same
+// layout as Intel's. Cores are counted per core rather than per package, so
+// the package is the only domain.
+static const uint32_t MSR_AMD_RAPL_POWER_UNIT   = 0xc0010299;
+static const uint32_t MSR_AMD_PKG_ENERGY_STATUS = 0xc001029b;
+
+// The MSRs one vendor's RAPL counters are read through.
+struct RaplMsrs
+{
+    uint32_t mPowerUnit;
+    uint32_t mEnergyStatus[kNumDomains];    // By DomainId; 0 if there is none.
+};
+
+static const RaplMsrs kIntelRaplMsrs = {
+    MSR_RAPL_POWER_UNIT,
+    { MSR_PKG_ENERGY_STATUS, MSR_PP0_ENERGY_STATUS, MSR_PP1_ENERGY_STATUS,
+      MSR_DRAM_ENERGY_STATUS }
+};
+
+static const RaplMsrs kAmdRaplMsrs = {
+    MSR_AMD_RAPL_POWER_UNIT,
+    { MSR_AMD_PKG_ENERGY_STATUS, 0, 0, 0 }
+};
+
+// Returns the RAPL MSRs of this machine's CPUs, or NULL if it has none we
+// know of, and sets |aFixedDramUnit| if DRAM energy is in the fixed unit.
+static const RaplMsrs*
+FindRaplMsrs(bool* aFixedDramUnit)
+{
+    *aFixedDramUnit = false;
+    char vendor[64];
+    int family, model;
+    if (!ReadCpuModel(vendor, sizeof(vendor), &family, &model)) {
+        return NULL;
+    }
+    if (strcmp(vendor, "GenuineIntel") == 0) {
+        for (size_t i = 0;
+             i < sizeof(kFixedDramUnitModels) / sizeof(kFixedDramUnitModels[0]);
+             i++) {
+            if (family == 6 && model == kFixedDramUnitModels[i]) {
+                *aFixedDramUnit = true;
+            }
+        }
+        return &kIntelRaplMsrs;
+    }
+    if ((strcmp(vendor, "AuthenticAMD") == 0 ||
+         strcmp(vendor, "HygonGenuine") == 0) && family >= 0x17) {
+        return &kAmdRaplMsrs;
+    }
+    return NULL;
+}
+
+const char* gMsrPathFormat = "/dev/cpu/%d/msr";
+
+// This class reads the RAPL energy status MSRs of one package directly
+// through the msr driver, for kernels without the perf power PMU and for
+// sampling rates where the cost of perf reads matters.
+//
+// The energy status counters are only 32 bits wide and wrap every few minutes
+// under load, so ticks are accumulated modulo 2^32, which is correct as long
+// as the sample interval is shorter than the wrap time.
+class MsrPackage : public Package
+{
+    int mFd;
+    const RaplMsrs& mMsrs;
+    double mJoulesPerTick[kNumDomains];
+    bool mIsSupported[kNumDomains];
+    uint32_t mPrevTicks[kNumDomains];
+    int64_t mPrev_ns;
+
+    bool ReadMsr(uint32_t aMsr, uint64_t* aOut)
+    {
+        return pread(mFd, aOut, sizeof(*aOut), aMsr) == sizeof(*aOut);
+    }
+
+public:
+    MsrPackage(int aCpu, const RaplMsrs& aMsrs, bool aFixedDramUnit)
+      : mMsrs(aMsrs), mPrev_ns(MonotonicNow_ns())
+    {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), gMsrPathFormat, aCpu);
+        mFd = open(path, O_RDONLY);
+        if (mFd < 0) {
+            Abort("failed to open %s: %s\n"
+                  "- Is the msr module loaded (|modprobe msr|) and are you "
+                  "root?", path, strerror(errno));
+        }
+
+        // Bits 12:8 hold the energy status unit, in 1/2^ESU Joules. Some
+        // server parts use a fixed unit for DRAM instead, which the perf
+        // backend gets from its .scale files.
+        uint64_t unit;
+        if (!ReadMsr(mMsrs.mPowerUnit, &unit)) {
+            Abort("failed to read the RAPL power unit MSR 0x%x from %s",
+                  mMsrs.mPowerUnit, path);
+        }
+        double esu_J = 1.0 / double(uint64_t(1) << ((unit >> 8) & 0x1f));
+        for (int i = 0; i < kNumDomains; i++) {
+            mJoulesPerTick[i] = esu_J;
+        }
+        if (aFixedDramUnit) {
+            mJoulesPerTick[kRam] = kFixedDramJoulesPerTick;
+        }
+
+        for (int i = 0; i < kNumDomains; i++) {
+            uint64_t ticks;
+            mIsSupported[i] = false;
+            mPrevTicks[i] = 0;
+            if (mMsrs.mEnergyStatus[i] == 0 ||
+                !ReadMsr(mMsrs.mEnergyStatus[i], &ticks)) {
+                continue;
+            }
+            mIsSupported[i] = true;
+            mPrevTicks[i] = uint32_t(ticks);
+        }
+        if (!mIsSupported[kPkg]) {
+            Abort("failed to read the pkg energy MSR from %s", path);
+        }
+    }
+
+    ~MsrPackage()
+    {
+        close(mFd);
+    }
+
+    virtual double JoulesPerTick(int aDomain) const
+    {
+        return mIsSupported[aDomain] ? mJoulesPerTick[aDomain] : 0;
+    }
+
+    virtual void Read(PackageSample& aSample)
+    {
+        for (int i = 0; i < kNumDomains; i++) {
+            uint64_t ticks = 0;
+            if (mIsSupported[i] && !ReadMsr(mMsrs.mEnergyStatus[i], &ticks)) {
+                Abort("pread() of MSR 0x%x failed", mMsrs.mEnergyStatus[i]);
+            }
+            uint32_t thisTicks = uint32_t(ticks);
+            aSample.mTicks[i] = uint32_t(thisTicks - mPrevTicks[i]);
+            mPrevTicks[i] = thisTicks;
+        }
+
+        int64_t now_ns = MonotonicNow_ns();
+        aSample.mWindow_ns = now_ns - mPrev_ns;
+        mPrev_ns = now_ns;
+    }
+};
+
+// Finds one online CPU for each package, using the CPU topology under
+// |gSysfsRoot|. |aCpus| is indexed by socket, in order of physical package id.
+// Returns the number of packages found.
+static int
+FindPackageCpus(int aCpus[kMaxSockets])
+{
+    char dirname[PATH_MAX];
+    snprintf(dirname, sizeof(dirname), "%s/devices/system/cpu", gSysfsRoot);
+    DIR* dir = opendir(dirname);
+    if (!dir) {
+        Abort("failed to open %s", dirname);
+    }
+
+    // The lowest numbered CPU of each package id, or -1.
+    int packageCpus[kMaxSockets];
+    for (int i = 0; i < kMaxSockets; i++) {
+        packageCpus[i] = -1;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        int cpu;
+        char rest;
+        if (sscanf(entry->d_name, "cpu%d%c", &cpu, &rest) != 1) {
+            continue;
+        }
+
+        // Offline CPUs have no topology directory.
+        char path[64];
+        int package;
+        sprintf(path, "devices/system/cpu/cpu%d/topology/physical_package_id",
+                cpu);
+        if (!ReadValueFromSysfsFile(path, "%d", &package)) {
+            continue;
+        }
+        if (package < 0 || package >= kMaxSockets) {
+            Abort("unexpected physical package id %d for cpu%d", package, cpu);
+        }
+        if (packageCpus[package] < 0 || cpu < packageCpus[package]) {
+            packageCpus[package] = cpu;
+        }
+    }
+    closedir(dir);
+
+    int numSockets = 0;
+    for (int i = 0; i < kMaxSockets; i++) {
+        if (packageCpus[i] >= 0) {
+            aCpus[numSockets++] = packageCpus[i];
+        }
+    }
+    if (numSockets == 0) {
+        Abort("no CPU topology found under %s", dirname);
+    }
+    return numSockets;
+}
+
+RAPL::RAPL(Backend aBackend)
+{
+    uint32_t type;
+    bool hasPowerPmu = ReadValueFromPowerFile("type", "", "", "%u", &type);
+    if (aBackend == Auto) {
+        aBackend = hasPowerPmu ? Perf : Msr;
+    } else if (aBackend == Perf && !hasPowerPmu) {
+        Abort("no power PMU found under %s", gSysfsRoot);
+    }
+
+    bool fixedDramUnit = false;
+    const RaplMsrs* msrs = NULL;
+    if (aBackend == Msr) {
+        msrs = FindRaplMsrs(&fixedDramUnit);
+        if (!msrs) {
+            Abort("no power PMU found under %s, and no RAPL MSRs known for "
+                  "this CPU", gSysfsRoot);
+        }
+    }
+
+    int cpus[kMaxSockets];
+    mNumSockets = FindPackageCpus(cpus);
+
+    for (int i = 0; i < mNumSockets; i++) {
+        if (aBackend == Perf) {
+            mPackages[i] = new PerfPackage(type, cpus[i]);
+        } else {
+            mPackages[i] = new MsrPackage(cpus[i], *msrs, fixedDramUnit);
+        }
+    }
+}
+
+RAPL::~RAPL()
+{
+    for (int i = 0; i < mNumSockets; i++) {
+        delete mPackages[i];
+    }
+}
+
+void
+AccumulateEstimate(double& aTotal_J, double aValue_J)
+{
+    if (aValue_J == kUnsupported_j) {
+        return;
+    }
+    aTotal_J = aTotal_J == kUnsupported_j ? aValue_J : aTotal_J + aValue_J;
+}
+
+//---------------------------------------------------------------------------
+// PAPI
+//---------------------------------------------------------------------------
+
+bool
+InitPapi()
+{
+    if (PAPI_is_initialized() != PAPI_NOT_INITED) {
+        return false;
+    }
+    if (PAPI_library_init(PAPI_VER_CURRENT) != PAPI_VER_CURRENT) {
+        Abort("PAPI failed to init.");
+    }
+    return true;
+}
+
+int
+Counters::NewGroup()
+{
+    if (mNumGroups == kMaxEvents) {
+        Abort("too many PAPI event sets");
+    }
+    int eventSet = PAPI_NULL;
+    if (PAPI_create_eventset(&eventSet) != PAPI_OK) {
+        Abort("PAPI failed to create the event set.\n");
+    }
+    if (mInherit) {
+        // Inheritance has to be set up before any events are added, and
+        // needs the event set bound to the CPU component first.
+        PAPI_option_t option;
+        memset(&option, 0, sizeof(option));
+        option.inherit.eventset = eventSet;
+        option.inherit.inherit = PAPI_INHERIT_ALL;
+        if (PAPI_assign_eventset_component(eventSet, 0) != PAPI_OK ||
+            PAPI_set_opt(PAPI_INHERIT, &option) != PAPI_OK) {
+            Abort("PAPI failed to make the event set inherited.\n");
+        }
+    }
+    mEventSets[mNumGroups] = eventSet;
+    mNumInGroup[mNumGroups] = 0;
+    return mNumGroups++;
+}
+
+Counters::Counters(bool aMultiplex, bool aInherit)
+  : mMultiplex(aMultiplex), mInherit(aInherit), mNumEvents(0),
+    mNumGroups(0), mActive(0), mPrimed(false), mEnabled_ns(0)
+{
+    NewGroup();
+}
+
+Counters::~Counters()
+{
+    for (int i = 0; i < mNumGroups; i++) {
+        PAPI_cleanup_eventset(mEventSets[i]);
+        PAPI_destroy_eventset(&mEventSets[i]);
+    }
+}
+
+int
+Counters::Add(int aCode, const char* aName)
+{
+    if (mNumEvents == kMaxEvents) {
+        Abort("too many events, the maximum is %d", kMaxEvents);
+    }
+    if (PAPI_query_event(aCode) != PAPI_OK) {
+        return PAPI_ENOEVNT;
+    }
+
+    int group = mNumGroups - 1;
+    int err = PAPI_add_event(mEventSets[group], aCode);
+    if (err != PAPI_OK && mMultiplex && mNumInGroup[group] > 0) {
+        // The PMU is full; start the next group.
+        group = NewGroup();
+        err = PAPI_add_event(mEventSets[group], aCode);
+    }
+    if (err != PAPI_OK) {
+        return mNumInGroup[group] > 0 ? PAPI_ECNFLCT : err;
+    }
+    mGroup[mNumEvents] = group;
+    mSlot[mNumEvents] = mNumInGroup[group]++;
+
+    mCodes[mNumEvents] = aCode;
+    mNames[mNumEvents] = aName;
+    mPrevCounts[mNumEvents] = 0;
+    mMeasured[mNumEvents] = false;
+    mRate[mNumEvents] = 0;
+    mRunning_ns[mNumEvents] = 0;
+    mNumEvents++;
+    return PAPI_OK;
+}
+
+int
+Counters::Attach(pid_t aPid)
+{
+    for (int i = 0; i < mNumGroups; i++) {
+        int err = PAPI_attach(mEventSets[i], aPid);
+        if (err != PAPI_OK) {
+            return err;
+        }
+    }
+    return PAPI_OK;
+}
+
+bool
+Counters::Start()
+{
+    // A multiplexing group is started eagerly and can end up empty if
+    // the next event failed to go into it.
+    if (mNumGroups > 1 && mNumInGroup[mNumGroups - 1] == 0) {
+        PAPI_destroy_eventset(&mEventSets[--mNumGroups]);
+    }
+
+    return PAPI_start(mEventSets[mActive]) == PAPI_OK;
+}
+
+bool
+Counters::Read(int64_t aInterval_ns, long_long* aValues, double* aScales)
+{
+    long_long counts[kMaxEvents] = {0};
+
+    if (!mMultiplex) {
+        if (PAPI_read(mEventSets[0], counts) != PAPI_OK) {
+            return false;
+        }
+        for (int i = 0; i < mNumEvents; i++) {
+            aValues[i] = counts[i] - mPrevCounts[i];
+            mPrevCounts[i] = counts[i];
+        }
+        return true;
+    }
+
+    // Switch to the next group straight away, so that it starts counting
+    // as close as possible to the start of the period. The first read only
+    // marks the start of the first period, so it restarts the same group.
+    int active = mActive;
+    if (PAPI_stop(mEventSets[active], counts) != PAPI_OK) {
+        return false;
+    }
+    if (mPrimed) {
+        mActive = (mActive + 1) % mNumGroups;
+    }
+    if (!Start()) {
+        return false;
+    }
+    if (!mPrimed) {
+        mPrimed = true;
+        for (int i = 0; i < mNumEvents; i++) {
+            aValues[i] = 0;
+            aScales[i] = 0;
+        }
+        return true;
+    }
+
+    mEnabled_ns += aInterval_ns;
+    for (int i = 0; i < mNumEvents; i++) {
+        if (mGroup[i] == active) {
+            aValues[i] = counts[mSlot[i]];
+            if (aInterval_ns > 0) {
+                mRate[i] = double(aValues[i]) / aInterval_ns;
+                mRunning_ns[i] += aInterval_ns;
+                mMeasured[i] = true;
+            }
+        } else {
+            aValues[i] = mMeasured[i] ? llround(mRate[i] * aInterval_ns) : 0;
+        }
+        aScales[i] = mEnabled_ns > 0 ? double(mRunning_ns[i]) / mEnabled_ns
+                                     : 0;
+    }
+    return true;
+}
+
+bool
+Counters::Stop()
+{
+    long_long counts[kMaxEvents];
+    return PAPI_stop(mEventSets[mActive], counts) == PAPI_OK;
+}
+
+void
+SplitEventNames(char* aList, const char** aNames, int& aNumNames)
+{
+    char* saveptr;
+    for (char* name = strtok_r(aList, ", \t\r\n", &saveptr); name;
+         name = strtok_r(NULL, ", \t\r\n", &saveptr)) {
+        if (aNumNames == kMaxEvents) {
+            Abort("too many events, the maximum is %d", kMaxEvents);
+        }
+        aNames[aNumNames++] = name;
+    }
+}
+
+const char* gEventCacheDir = NULL;
+
+// Fills in |aPath| with the event cache file for this CPU model and PAPI
+// version. Returns false if there is no cache, or the CPU model is unknown.
+static bool
+EventCachePath(char* aPath, size_t aSize)
+{
+    if (!gEventCacheDir) {
+        return false;
+    }
+    char vendor[64];
+    int family, model;
+    if (!ReadCpuModel(vendor, sizeof(vendor), &family, &model)) {
+        return false;
+    }
+    snprintf(aPath, aSize, "%s/events-%s-%d-%d-papi-%x.txt", gEventCacheDir,
+             vendor, family, model, unsigned(PAPI_VER_CURRENT));
+    return true;
+}
+
+// Reads the event names in the cache file |aPath| into |aNames|. Returns the
+// file's contents, which the names point into, or NULL if there is none.
+static char*
+ReadEventCache(const char* aPath, const char** aNames, int& aNumNames)
+{
+    FILE* in = fopen(aPath, "r");
+    if (!in) {
+        return NULL;
+    }
+    char* text = NULL;
+    size_t size = 0;
+    if (getdelim(&text, &size, '\0', in) < 0) {
+        free(text);
+        text = NULL;
+    }
+    fclose(in);
+
+    char* saveptr;
+    for (char* name = text ? strtok_r(text, "\n", &saveptr) : NULL;
+         name && aNumNames < kMaxEvents; name = strtok_r(NULL, "\n", &saveptr)) {
+        aNames[aNumNames++] = name;
+    }
+    return text;
+}
+
+// Replaces the cache file |aPath| with |aNames|. The cache is only an
+// optimization, so failing to write it is not an error.
+static void
+WriteEventCache(const char* aPath, const char** aNames, int aNumNames)
+{
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", gEventCacheDir);
+    for (char* p = dir + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(dir, 0755);
+            *p = '/';
+        }
+    }
+    mkdir(dir, 0755);
+
+    // Written aside and renamed, so concurrent runs never see half a file.
+    char temp[PATH_MAX + 16];
+    snprintf(temp, sizeof(temp), "%s.%d", aPath, int(getpid()));
+    FILE* out = fopen(temp, "w");
+    if (!out) {
+        return;
+    }
+    for (int i = 0; i < aNumNames; i++) {
+        fprintf(out, "%s\n", aNames[i]);
+    }
+    if (fclose(out) != 0 || rename(temp, aPath) != 0) {
+        unlink(temp);
+    }
+}
+
+static bool
+IsListed(const char* aName, const char** aNames, int aNumNames)
+{
+    for (int i = 0; i < aNumNames; i++) {
+        if (strcmp(aName, aNames[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+AddEvents(Counters* aCounters, const char** aNames, int aNumNames,
+          bool aStrict)
+{
+    char* report = NULL;
+    size_t reportSize;
+    FILE* out = open_memstream(&report, &reportSize);
+    int numBad = 0, numConflicts = 0;
+
+    // The events known to be missing, and whether any more were found.
+    char cachePath[PATH_MAX];
+    bool useCache = !aStrict && EventCachePath(cachePath, sizeof(cachePath));
+    const char* missing[kMaxEvents];
+    int numMissing = 0;
+    char* cacheText = useCache ? ReadEventCache(cachePath, missing, numMissing)
+                               : NULL;
+    bool foundMissing = false;
+
+    for (int i = 0; i < aNumNames; i++) {
+        const char* name = aNames[i];
+        int code;
+        int err = PAPI_OK;
+        if (useCache && IsListed(name, missing, numMissing)) {
+            fprintf(stderr, "skipping %s: not available on this CPU (cached)\n",
+                    name);
+            continue;
+        }
+        if (strlen(name) >= size_t(kMaxEventNameLen)) {
+            fprintf(out, "  %s: name longer than %d characters\n", name,
+                    kMaxEventNameLen - 1);
+        } else if (PAPI_event_name_to_code(name, &code) != PAPI_OK) {
+            fprintf(out, "  %s: unknown event\n", name);
+        } else if ((err = aCounters->Add(code, name)) == PAPI_OK) {
+            continue;
+        } else if (err == PAPI_ENOEVNT) {
+            if (!aStrict) {
+                fprintf(stderr, "skipping %s: not available on this CPU\n",
+                        name);
+                if (useCache && numMissing < kMaxEvents) {
+                    missing[numMissing++] = name;
+                    foundMissing = true;
+                }
+                continue;
+            }
+            fprintf(out, "  %s: not available on this CPU\n", name);
+        } else if (err == PAPI_ECNFLCT) {
+            fprintf(out, "  %s: cannot be counted together with", name);
+            for (int j = 0; j < aCounters->NumEvents(); j++) {
+                fprintf(out, " %s", aCounters->Name(j));
+            }
+            fprintf(out, "\n");
+            numConflicts++;
+        } else {
+            fprintf(out, "  %s: %s\n", name, PAPI_strerror(err));
+        }
+        numBad++;
+    }
+    fclose(out);
+
+    if (foundMissing) {
+        WriteEventCache(cachePath, missing, numMissing);
+    }
+    free(cacheText);
+
+    if (numBad > 0) {
+        fprintf(stderr, "%s: %d of %d events cannot be counted:\n%s",
+                program_invocation_name,
+                numBad, aNumNames, report);
+        if (numConflicts > 0) {
+            fprintf(stderr, "Use --multiplex to count events that cannot be "
+                    "scheduled together.\n");
+        }
+        exit(1);
+    }
+    free(report);
+    if (aCounters->NumEvents() == 0) {
+        Abort("none of the events can be counted on this CPU");
+    }
+}
+
+//---------------------------------------------------------------------------
+// Regions
+//---------------------------------------------------------------------------
+
+static RAPL* gRegionRapl;
+static Counters* gRegionCounters;   // NULL if there are no events.
+static char* gRegionEventList;      // The event names point into this.
+static const char* gRegionEventNames[kMaxEvents];
+static bool gInitedPapi;            // Did PowerInit() initialize PAPI?
+
+// The RAPL ticks and counts since PowerInit(). Regions take the difference
+// between their ends.
+static uint64_t gTotalTicks[kMaxSockets][kNumDomains];
+static long_long gTotalCounts[kMaxEvents];
+
+struct Region
+{
+    const char* mName;
+    int64_t mStart_ns;
+    uint64_t mTicks[kMaxSockets][kNumDomains];
+    long_long mCounts[kMaxEvents];
+};
+
+static Region gRegions[kMaxRegionDepth];
+static int gDepth;
+
+static void
+UpdateTotals()
+{
+    for (int i = 0; i < gRegionRapl->NumSockets(); i++) {
+        PackageSample sample;
+        gRegionRapl->Read(i, sample);
+        for (int d = 0; d < kNumDomains; d++) {
+            gTotalTicks[i][d] += sample.mTicks[d];
+        }
+    }
+    if (gRegionCounters) {
+        long_long values[kMaxEvents];
+        if (!gRegionCounters->Read(0, values, NULL)) {
+            Abort("PAPI_read() failed");
+        }
+        for (int i = 0; i < gRegionCounters->NumEvents(); i++) {
+            gTotalCounts[i] += values[i];
+        }
+    }
+}
+
+void
+PowerInit(RAPL::Backend aBackend, const char* aEvents)
+{
+    if (gRegionRapl) {
+        Abort("PowerInit() was called twice");
+    }
+    gRegionRapl = new RAPL(aBackend);
+
+    int numNames = 0;
+    if (aEvents) {
+        gRegionEventList = strdup(aEvents);
+        SplitEventNames(gRegionEventList, gRegionEventNames, numNames);
+    }
+    // PAPI is only initialized if there is something to count, since that
+    // is the slowest part of starting up.
+    if (numNames > 0) {
+        gInitedPapi = InitPapi();
+        gRegionCounters = new Counters(/* aMultiplex = */ false,
+                                       /* aInherit = */ false);
+        AddEvents(gRegionCounters, gRegionEventNames, numNames,
+                  /* aStrict = */ false);
+        if (!gRegionCounters->Start()) {
+            Abort("PAPI_start() failed");
+        }
+    }
+
+    // The first reads only set the baselines.
+    UpdateTotals();
+    memset(gTotalTicks, 0, sizeof(gTotalTicks));
+    memset(gTotalCounts, 0, sizeof(gTotalCounts));
+    gDepth = 0;
+}
+
+void
+PowerShutdown()
+{
+    if (gRegionCounters) {
+        gRegionCounters->Stop();
+        delete gRegionCounters;
+        gRegionCounters = NULL;
+    }
+    delete gRegionRapl;
+    gRegionRapl = NULL;
+    free(gRegionEventList);
+    gRegionEventList = NULL;
+    if (gInitedPapi) {
+        PAPI_shutdown();
+        gInitedPapi = false;
+    }
+}
+
+int
+PowerNumEvents()
+{
+    return gRegionCounters ? gRegionCounters->NumEvents() : 0;
+}
+
+const char*
+PowerEventName(int aIndex)
+{
+    return gRegionCounters->Name(aIndex);
+}
+
+void
+RegionBegin(const char* aName)
+{
+    if (!gRegionRapl) {
+        Abort("RegionBegin(\"%s\") before PowerInit()", aName);
+    }
+    if (gDepth == kMaxRegionDepth) {
+        Abort("regions nest more than %d deep", kMaxRegionDepth);
+    }
+    UpdateTotals();
+    Region& region = gRegions[gDepth++];
+    region.mName = aName;
+    memcpy(region.mTicks, gTotalTicks, sizeof(gTotalTicks));
+    memcpy(region.mCounts, gTotalCounts, sizeof(gTotalCounts));
+    // Last, so that the reads above aren't part of the region.
+    region.mStart_ns = MonotonicNow_ns();
+}
+
+void
+RegionEnd(RegionResult* aResult)
+{
+    int64_t end_ns = MonotonicNow_ns();
+    if (gDepth == 0) {
+        Abort("RegionEnd() without RegionBegin()");
+    }
+    UpdateTotals();
+    const Region& region = gRegions[--gDepth];
+
+    aResult->mName = region.mName;
+    aResult->mSeconds = (end_ns - region.mStart_ns) / 1e9;
+    for (int d = 0; d < kNumDomains; d++) {
+        aResult->mEnergy_J[d] = kUnsupported_j;
+        for (int i = 0; i < gRegionRapl->NumSockets(); i++) {
+            double joulesPerTick = gRegionRapl->JoulesPerTick(i, d);
+            if (joulesPerTick != 0) {
+                AccumulateEstimate(aResult->mEnergy_J[d],
+                                   (gTotalTicks[i][d] - region.mTicks[i][d]) *
+                                   joulesPerTick);
+            }
+        }
+    }
+    aResult->mNumEvents = PowerNumEvents();
+    for (int i = 0; i < aResult->mNumEvents; i++) {
+        aResult->mValues[i] = gTotalCounts[i] - region.mCounts[i];
+    }
+}
+
+void
+PrintRegion(FILE* aOut, const RegionResult& aResult)
+{
+    fprintf(aOut, "%s: %.6f s", aResult.mName, aResult.mSeconds);
+    for (int d = 0; d < kNumDomains; d++) {
+        if (aResult.mEnergy_J[d] == kUnsupported_j) {
+            fprintf(aOut, ", %s n/a", kDomainNames[d]);
+        } else {
+            fprintf(aOut, ", %s %.3f J (%.2f W)", kDomainNames[d],
+                    aResult.mEnergy_J[d],
+                    aResult.mSeconds > 0 ? aResult.mEnergy_J[d] / aResult.mSeconds
+                                         : 0);
+        }
+    }
+    for (int i = 0; i < aResult.mNumEvents; i++) {
+        fprintf(aOut, ", %s %lld", PowerEventName(i), aResult.mValues[i]);
+    }
+    fprintf(aOut, "\n");
+}
@@ -0,0 +1,255 @@
+#ifndef PAPIPOWER_H
+#define PAPIPOWER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "papi.h"
+
+// libpapipower: the RAPL and PAPI machinery that rp_t2 samples with, for
+// programs that want to measure their own regions of code. As in rp_t2,
+// failing to set up RAPL or PAPI is fatal: the error is printed and the
+// process exits.
+
+int64_t MonotonicNow_ns();
+
+// The root of the sysfs tree that the power PMU and the CPU topology are read
+// from, the per-CPU MSR device, where "%d" is replaced by the CPU number, and
+// the cpuinfo file the CPU's vendor and model are read from. They can be
+// pointed at fakes before a RAPL is created.
+extern const char* gSysfsRoot;
+extern const char* gMsrPathFormat;
+extern const char* gCpuInfoPath;
+
+//---------------------------------------------------------------------------
+// RAPL
+//---------------------------------------------------------------------------
+
+// The RAPL domains, in the order they are opened and reported.
+enum DomainId { kPkg, kCores, kGpu, kRam, kNumDomains };
+
+extern const char* const kDomainNames[kNumDomains];
+
+// A special value that represents an estimate from an unsupported RAPL domain.
+static const double kUnsupported_j = -1.0;
+
+// Adds a per-socket estimate into a machine-wide total. The total stays
+// kUnsupported_j only if no socket supports the domain.
+void AccumulateEstimate(double& aTotal_J, double aValue_J);
+
+// The RAPL counters of one package over one sample period.
+struct PackageSample
+{
+    uint64_t mTicks[kNumDomains];   // Zero for unsupported domains.
+    uint64_t mWindow_ns;            // The period the ticks cover.
+};
+
+// The interface to the RAPL counters of one package. There is one
+// implementation per backend.
+class Package
+{
+public:
+    virtual ~Package() {}
+
+    // Returns 0 for an unsupported domain.
+    virtual double JoulesPerTick(int aDomain) const = 0;
+
+    virtual void Read(PackageSample& aSample) = 0;
+};
+
+// The most sockets we report on. Plenty for anything with RAPL.
+static const int kMaxSockets = 16;
+
+// This class reads all the RAPL domains of every package in the machine.
+class RAPL
+{
+    int mNumSockets;
+    Package* mPackages[kMaxSockets];
+
+public:
+    enum Backend { Auto, Perf, Msr };
+
+    // |Auto| uses the perf power PMU if the kernel has one, and the MSRs
+    // otherwise, on Intel CPUs and on AMD and Hygon ones from family 17h.
+    explicit RAPL(Backend aBackend);
+    ~RAPL();
+
+    int NumSockets() const { return mNumSockets; }
+
+    void Read(int aSocket, PackageSample& aSample)
+    {
+        mPackages[aSocket]->Read(aSample);
+    }
+
+    // Returns 0 for an unsupported domain.
+    double JoulesPerTick(int aSocket, int aDomain) const
+    {
+        return mPackages[aSocket]->JoulesPerTick(aDomain);
+    }
+};
+
+//---------------------------------------------------------------------------
+// PAPI
+//---------------------------------------------------------------------------
+
+// Initializes PAPI if nothing has yet. Returns true if this call did.
+bool InitPapi();
+
+// The most events a sample can carry, and the longest event name we keep.
+static const int kMaxEvents = 128;
+static const int kMaxEventNameLen = 64;
+
+// This class owns the PAPI event sets. Normally every event goes into one
+// event set whose counters run freely and are diffed between samples.
+//
+// With multiplexing, events are packed into as many event sets as the PMU
+// needs, and one set counts per sample period, in rotation. An event that was
+// not counted during a period is estimated from its rate in the last period it
+// was counted, and its scale is the fraction of the run, so far, during which
+// it was actually counted (as in the percentages |perf stat| prints).
+class Counters
+{
+    bool mMultiplex;
+    bool mInherit;
+    int mNumEvents;
+    int mCodes[kMaxEvents];
+    const char* mNames[kMaxEvents];
+    int mGroup[kMaxEvents];         // The index in |mEventSets|.
+    int mSlot[kMaxEvents];          // The index within that event set.
+
+    int mNumGroups;
+    int mEventSets[kMaxEvents];
+    int mNumInGroup[kMaxEvents];
+    int mActive;                    // The event set that is counting.
+
+    long_long mPrevCounts[kMaxEvents];
+
+    // These are only used when multiplexing.
+    bool mPrimed;                   // Has the first period started?
+    bool mMeasured[kMaxEvents];     // Has the event been counted yet?
+    double mRate[kMaxEvents];       // Its count per ns when it was last counted.
+    int64_t mRunning_ns[kMaxEvents];
+    int64_t mEnabled_ns;
+
+    int NewGroup();
+
+public:
+    // With |aInherit| the counts include every thread and child process
+    // that the counted process creates after the counters start.
+    Counters(bool aMultiplex, bool aInherit);
+    ~Counters();
+
+    int NumEvents() const { return mNumEvents; }
+    int NumGroups() const { return mNumGroups; }
+    const char* Name(int aIndex) const { return mNames[aIndex]; }
+    int Code(int aIndex) const { return mCodes[aIndex]; }
+    bool IsMultiplexed() const { return mMultiplex; }
+
+    // Adds an event. Returns PAPI_OK, PAPI_ENOEVNT if the event isn't
+    // available, PAPI_ECNFLCT if it can't be counted together with the events
+    // already added (which only happens without multiplexing) or whatever
+    // else PAPI_add_event() returned. |aName| must outlive this object.
+    int Add(int aCode, const char* aName);
+
+    // Counts only the process or thread |aPid|, instead of this process.
+    // Must be called after all the events are added. Returns PAPI_OK or the
+    // PAPI_attach() error.
+    int Attach(pid_t aPid);
+
+    bool Start();
+
+    // Fills in each event's count for the period of |aInterval_ns| that ended
+    // now. When multiplexing, |aScales| gets each event's scale. Returns
+    // false if the counters can't be read, e.g. because the thread they are
+    // attached to has exited.
+    bool Read(int64_t aInterval_ns, long_long* aValues, double* aScales);
+
+    bool Stop();
+};
+
+// Appends the event names in |aList|, separated by commas or white space, to
+// |aNames|. |aList| is modified and must outlive |aNames|.
+void SplitEventNames(char* aList, const char** aNames, int& aNumNames);
+
+// A directory to cache which events are missing in, or NULL for no cache.
+// Each CPU model and PAPI version has a file there, listing the events that
+// AddEvents() has found the CPU doesn't have, and later runs skip those
+// without asking PAPI.
+extern const char* gEventCacheDir;
+
+// Resolves and adds every event before anything starts counting, so that all
+// the problems are reported together. Preset and native event names are both
+// accepted. With |aStrict| false, events the CPU doesn't have are skipped
+// with a warning, and the event cache is used.
+void AddEvents(Counters* aCounters, const char** aNames, int aNumNames,
+               bool aStrict);
+
+//---------------------------------------------------------------------------
+// Regions
+//---------------------------------------------------------------------------
+
+// The energy and counts of one region of code. The energy is the whole
+// machine's, as RAPL measures it, while the counts are only those of the
+// thread that called PowerInit().
+struct RegionResult
+{
+    const char* mName;
+    double mSeconds;
+    double mEnergy_J[kNumDomains];  // Machine totals, kUnsupported_j if none.
+    int mNumEvents;
+    long_long mValues[kMaxEvents];  // In the order of PowerEventName().
+};
+
+// The most regions that can be open at once.
+static const int kMaxRegionDepth = 32;
+
+// Sets up the measurements that regions use: RAPL through |aBackend|, and the
+// PAPI events in |aEvents|, separated as for SplitEventNames(), or none if it
+// is NULL. Events the CPU doesn't have are skipped with a warning.
+//
+// The region functions are not thread-safe, and are meant to be called on
+// the thread that called PowerInit().
+void PowerInit(RAPL::Backend aBackend, const char* aEvents);
+void PowerShutdown();
+
+int PowerNumEvents();
+const char* PowerEventName(int aIndex);
+
+// Starts a region. Regions nest, and |aName| must outlive the region.
+void RegionBegin(const char* aName);
+
+// Ends the innermost region and fills in |aResult| with what it used.
+//
+// With the msr backend, the RAPL counters are 32 bits and wrap every few
+// minutes under load, so regions longer than that need something else to call
+// RegionBegin() or RegionEnd() in between.
+void RegionEnd(RegionResult* aResult);
+
+// Prints |aResult| on one line, like "fft: 1.234 s, pkg 12.3 J (10.0 W), ...".
+void PrintRegion(FILE* aOut, const RegionResult& aResult);
+
+// This class measures the scope it is declared in as a region, and fills in
+// |aResult| when it ends, or prints it to stderr if |aResult| is NULL.
+class ScopedMeasure
+{
+    RegionResult* mResult;
+
+public:
+    explicit ScopedMeasure(const char* aName, RegionResult* aResult = NULL)
+      : mResult(aResult)
+    {
+        RegionBegin(aName);
+    }
+
+    ~ScopedMeasure()
+    {
+        RegionResult result;
+        RegionEnd(mResult ? mResult : &result);
+        if (!mResult) {
+            PrintRegion(stderr, result);
+        }
+    }
+};
+
+#endif // PAPIPOWER_H
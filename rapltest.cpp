@@ -0,0 +1,336 @@
+#include "papipower.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Tests the MSR backend of RAPL against a fake sysfs tree, cpuinfo file and
+// MSR device: the 32-bit energy counters wrapping between reads, the fixed
+// DRAM unit of Intel's server parts, an MSR that can't be read, AMD's MSRs,
+// and a CPU without any RAPL MSRs we know of. Then it measures regions of
+// code through the same fakes, as a program using libpapipower would. Run by
+// |make check|.
+
+static char gDir[] = "/tmp/rapltest.XXXXXX";
+static char gSysfs[PATH_MAX];
+static char gCpuInfo[PATH_MAX];
+static char gMsr[PATH_MAX];
+static char gMsrFormat[PATH_MAX];
+
+static int gNumChecks = 0;
+static int gNumFailed = 0;
+
+static void
+Abort(const char* aFormat, ...)
+{
+    va_list vargs;
+    va_start(vargs, aFormat);
+    fprintf(stderr, "rapltest: ");
+    vfprintf(stderr, aFormat, vargs);
+    fprintf(stderr, "\n");
+    va_end(vargs);
+
+    exit(1);
+}
+
+static void
+Check(bool aOk, const char* aFormat, ...)
+{
+    gNumChecks++;
+    if (aOk) {
+        return;
+    }
+    gNumFailed++;
+    va_list vargs;
+    va_start(vargs, aFormat);
+    fprintf(stderr, "FAIL: ");
+    vfprintf(stderr, aFormat, vargs);
+    fprintf(stderr, "\n");
+    va_end(vargs);
+}
+
+static void
+WriteFile(const char* aPath, const char* aContents)
+{
+    FILE* out = fopen(aPath, "w");
+    if (!out || fputs(aContents, out) < 0 || fclose(out) != 0) {
+        Abort("failed to write %s", aPath);
+    }
+}
+
+// One package, cpu0, and no power PMU, so that |Auto| picks the MSRs.
+static void
+MakeSysfs()
+{
+    const char* dirs[] = { "", "/devices", "/devices/system",
+                           "/devices/system/cpu", "/devices/system/cpu/cpu0",
+                           "/devices/system/cpu/cpu0/topology" };
+    char path[PATH_MAX + 64];
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        snprintf(path, sizeof(path), "%s%s", gSysfs, dirs[i]);
+        if (mkdir(path, 0755) != 0) {
+            Abort("failed to create %s", path);
+        }
+    }
+    snprintf(path, sizeof(path),
+             "%s/devices/system/cpu/cpu0/topology/physical_package_id", gSysfs);
+    WriteFile(path, "0\n");
+}
+
+static void
+SetCpu(const char* aVendor, int aFamily, int aModel)
+{
+    char contents[256];
+    snprintf(contents, sizeof(contents),
+             "processor\t: 0\nvendor_id\t: %s\ncpu family\t: %d\n"
+             "model\t\t: %d\nmodel name\t: Fake CPU\n", aVendor, aFamily,
+             aModel);
+    WriteFile(gCpuInfo, contents);
+}
+
+// Empties the MSR device, so that MSRs past the last one written can't be
+// read, as on a CPU without them.
+static void
+ClearMsrs()
+{
+    int fd = open(gMsr, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        Abort("failed to create %s", gMsr);
+    }
+    close(fd);
+}
+
+static void
+WriteMsr(uint32_t aMsr, uint64_t aValue)
+{
+    int fd = open(gMsr, O_WRONLY);
+    if (fd < 0 || pwrite(fd, &aValue, sizeof(aValue), aMsr) != sizeof(aValue)) {
+        Abort("failed to write MSR 0x%x to %s", aMsr, gMsr);
+    }
+    close(fd);
+}
+
+// The energy status unit field holds the power of two the unit divides a
+// Joule by.
+static uint64_t
+EnergyUnit(int aShift)
+{
+    return uint64_t(aShift) << 8;
+}
+
+// An Intel server part: DRAM is in 2^-16 J whatever the unit MSR says, and
+// counters that wrap between reads still give the ticks in between. The bits
+// above 31 are reserved, and must be ignored.
+static void
+TestIntelServer()
+{
+    SetCpu("GenuineIntel", 6, 0x55);
+    ClearMsrs();
+    WriteMsr(0x606, EnergyUnit(14));
+    WriteMsr(0x611, 0xfffff000);
+    WriteMsr(0x619, 0xfffffff0);
+    WriteMsr(0x639, 100);
+    WriteMsr(0x641, 0);
+
+    RAPL rapl(RAPL::Msr);
+    Check(rapl.NumSockets() == 1, "intel server: %d sockets",
+          rapl.NumSockets());
+    Check(rapl.JoulesPerTick(0, kPkg) == 1.0 / 16384,
+          "intel server: pkg unit %g", rapl.JoulesPerTick(0, kPkg));
+    Check(rapl.JoulesPerTick(0, kRam) == 1.0 / 65536,
+          "intel server: ram unit %g", rapl.JoulesPerTick(0, kRam));
+
+    WriteMsr(0x611, 0xabcd00000800ULL);
+    WriteMsr(0x619, 0x10);
+    WriteMsr(0x639, 300);
+    PackageSample sample;
+    rapl.Read(0, sample);
+    Check(sample.mTicks[kPkg] == 0x1800, "intel server: pkg wrapped to %llu",
+          (unsigned long long)sample.mTicks[kPkg]);
+    Check(sample.mTicks[kRam] == 0x20, "intel server: ram wrapped to %llu",
+          (unsigned long long)sample.mTicks[kRam]);
+    Check(sample.mTicks[kCores] == 200, "intel server: cores %llu",
+          (unsigned long long)sample.mTicks[kCores]);
+}
+
+// An Intel client part, whose DRAM is in the unit MSR's unit, on a device
+// that ends before MSR_PP1_ENERGY_STATUS, so that domain is unsupported.
+static void
+TestIntelClient()
+{
+    SetCpu("GenuineIntel", 6, 0x9e);
+    ClearMsrs();
+    WriteMsr(0x606, EnergyUnit(14));
+    WriteMsr(0x611, 1000);
+    WriteMsr(0x619, 0);
+    WriteMsr(0x639, 0);
+
+    RAPL rapl(RAPL::Msr);
+    Check(rapl.JoulesPerTick(0, kRam) == 1.0 / 16384,
+          "intel client: ram unit %g", rapl.JoulesPerTick(0, kRam));
+    Check(rapl.JoulesPerTick(0, kGpu) == 0, "intel client: gpu unit %g",
+          rapl.JoulesPerTick(0, kGpu));
+
+    WriteMsr(0x611, 3000);
+    PackageSample sample;
+    rapl.Read(0, sample);
+    Check(sample.mTicks[kPkg] == 2000, "intel client: pkg %llu",
+          (unsigned long long)sample.mTicks[kPkg]);
+    Check(sample.mTicks[kGpu] == 0, "intel client: gpu %llu",
+          (unsigned long long)sample.mTicks[kGpu]);
+}
+
+// AMD counts only the package, through MSRs of its own, which |Auto| falls
+// back to without a power PMU.
+static void
+TestAmd()
+{
+    SetCpu("AuthenticAMD", 0x19, 0x21);
+    ClearMsrs();
+    WriteMsr(0x606, EnergyUnit(1));
+    WriteMsr(0xc0010299, EnergyUnit(16));
+    WriteMsr(0xc001029b, 0xffffff00);
+
+    RAPL rapl(RAPL::Auto);
+    Check(rapl.JoulesPerTick(0, kPkg) == 1.0 / 65536, "amd: pkg unit %g",
+          rapl.JoulesPerTick(0, kPkg));
+    for (int d = kCores; d < kNumDomains; d++) {
+        Check(rapl.JoulesPerTick(0, d) == 0, "amd: %s unit %g",
+              kDomainNames[d], rapl.JoulesPerTick(0, d));
+    }
+
+    WriteMsr(0xc001029b, 0x100);
+    PackageSample sample;
+    rapl.Read(0, sample);
+    Check(sample.mTicks[kPkg] == 0x200, "amd: pkg wrapped to %llu",
+          (unsigned long long)sample.mTicks[kPkg]);
+}
+
+// A CPU without known RAPL MSRs is refused, rather than read at Intel's
+// addresses.
+static void
+TestUnknownVendor()
+{
+    SetCpu("CentaurHauls", 7, 0x3b);
+    ClearMsrs();
+    WriteMsr(0x606, EnergyUnit(14));
+    WriteMsr(0x611, 0);
+    WriteMsr(0x639, 0);
+
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        Abort("fork() failed");
+    }
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDERR_FILENO);
+        RAPL rapl(RAPL::Auto);
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    Check(WIFEXITED(status) && WEXITSTATUS(status) == 1,
+          "unknown vendor: RAPL() didn't fail");
+}
+
+// Keeps the CPU busy for |aTime_ns|.
+static void
+Spin(int64_t aTime_ns)
+{
+    int64_t end_ns = MonotonicNow_ns() + aTime_ns;
+    while (MonotonicNow_ns() < end_ns) {
+    }
+}
+
+// Regions around a known workload, which spins for a while and adds a known
+// number of ticks to the fake package counter. Each inner region adds three
+// quarters of the counter's range, so the outer region spans more ticks than
+// the counter holds, and only gets them all because the inner regions read
+// the counters in between, as the msr backend needs.
+static void
+TestRegions()
+{
+    SetCpu("GenuineIntel", 6, 0x55);
+    ClearMsrs();
+    WriteMsr(0x606, EnergyUnit(14));
+    uint32_t pkg = 0xfff00000;
+    WriteMsr(0x611, pkg);
+    WriteMsr(0x619, 0);
+    WriteMsr(0x639, 0);
+    WriteMsr(0x641, 0);
+
+    PowerInit(RAPL::Msr, NULL);
+    Check(PowerNumEvents() == 0, "regions: %d events", PowerNumEvents());
+
+    const uint32_t kInnerTicks = 0xc0000000;
+    const double kInner_J = kInnerTicks / 16384.0;
+    RegionBegin("outer");
+    RegionResult inner;
+    for (int i = 0; i < 3; i++) {
+        ScopedMeasure measure("inner", &inner);
+        pkg += kInnerTicks;
+        WriteMsr(0x611, pkg);
+        Spin(20000000);
+    }
+    RegionResult outer;
+    RegionEnd(&outer);
+    PowerShutdown();
+
+    Check(strcmp(inner.mName, "inner") == 0 && inner.mSeconds >= 0.02 &&
+          inner.mSeconds < 1, "regions: inner took %.6f s", inner.mSeconds);
+    Check(inner.mEnergy_J[kPkg] == kInner_J, "regions: inner used %.3f J",
+          inner.mEnergy_J[kPkg]);
+    Check(inner.mEnergy_J[kRam] == 0, "regions: inner used %.3f J of ram",
+          inner.mEnergy_J[kRam]);
+    Check(strcmp(outer.mName, "outer") == 0 && outer.mSeconds >= 0.06 &&
+          outer.mSeconds < 3, "regions: outer took %.6f s", outer.mSeconds);
+    Check(outer.mEnergy_J[kPkg] == 3 * kInner_J, "regions: outer used %.3f J",
+          outer.mEnergy_J[kPkg]);
+
+    char* line = NULL;
+    size_t len = 0;
+    FILE* out = open_memstream(&line, &len);
+    PrintRegion(out, outer);
+    fclose(out);
+    Check(strncmp(line, "outer: ", 7) == 0 &&
+          strstr(line, ", pkg 589824.000 J (") != NULL &&
+          line[len - 1] == '\n', "regions: printed %s", line);
+    free(line);
+}
+
+int
+main()
+{
+    if (!mkdtemp(gDir)) {
+        Abort("mkdtemp() failed");
+    }
+    snprintf(gSysfs, sizeof(gSysfs), "%s/sys", gDir);
+    snprintf(gCpuInfo, sizeof(gCpuInfo), "%s/cpuinfo", gDir);
+    snprintf(gMsr, sizeof(gMsr), "%s/msr0", gDir);
+    snprintf(gMsrFormat, sizeof(gMsrFormat), "%s/msr%%d", gDir);
+    MakeSysfs();
+    gSysfsRoot = gSysfs;
+    gCpuInfoPath = gCpuInfo;
+    gMsrPathFormat = gMsrFormat;
+
+    TestIntelServer();
+    TestIntelClient();
+    TestAmd();
+    TestUnknownVendor();
+    TestRegions();
+
+    char command[PATH_MAX + 16];
+    snprintf(command, sizeof(command), "rm -rf %s", gDir);
+    if (system(command) != 0) {
+        fprintf(stderr, "rapltest: failed to remove %s\n", gDir);
+    }
+
+    printf("rapltest: %d checks, %d failed\n", gNumChecks, gNumFailed);
+    return gNumFailed > 0 ? 1 : 0;
+}
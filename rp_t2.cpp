@@ -6,95 +6,36 @@
 #include <stdint.h>
 #include <string.h>
 
-#include "papi.h"
+#include <atomic>
+
+#include "papipower.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <sys/time.h>
+#include <time.h>
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 
 int sampleInterval_msec = 1000;
 int sampleCount = 10;
 
-const int MAX_ADD_EVENTS = 6;
-
-// ./papi_avail | grep Yes | awk '{print $1}' | sed 's/$/&,/g'
-static int all_select_preset_events[] = {
-    PAPI_L1_DCM,
-    PAPI_L1_ICM,
-    PAPI_L2_DCM,
-    PAPI_L2_ICM,
-    PAPI_L1_TCM,
-    PAPI_L2_TCM,
-    
-    PAPI_L3_TCM,
-    PAPI_CA_SNP,
-    PAPI_CA_SHR,
-    PAPI_CA_CLN,
-    PAPI_CA_ITV,
-    PAPI_L3_LDM,
-    
-    PAPI_TLB_DM,
-    PAPI_TLB_IM,
-    PAPI_L1_LDM,
-    PAPI_L1_STM,
-    PAPI_L2_LDM,
-    PAPI_L2_STM,
-    
-    PAPI_PRF_DM,
-    PAPI_MEM_WCY,
-    PAPI_STL_ICY,
-    PAPI_FUL_ICY,
-    PAPI_STL_CCY,
-    PAPI_FUL_CCY,
-    
-    PAPI_BR_UCN,
-    PAPI_BR_CN,
-    PAPI_BR_TKN,
-    PAPI_BR_NTK,
-    PAPI_BR_MSP,
-    PAPI_BR_PRC,
-    
-    PAPI_TOT_INS,
-    PAPI_LD_INS,
-    PAPI_SR_INS,
-    PAPI_BR_INS,
-    PAPI_RES_STL,
-    PAPI_TOT_CYC,
-    
-    PAPI_LST_INS,
-    PAPI_L2_DCA,
-    PAPI_L3_DCA,
-    PAPI_L2_DCR,
-    PAPI_L3_DCR,
-    PAPI_L2_DCW,
-    
-    PAPI_L3_DCW,
-    PAPI_L2_ICH,
-    PAPI_L2_ICA,
-    PAPI_L3_ICA,
-    PAPI_L2_ICR,
-    PAPI_L3_ICR,
-    
-    PAPI_L2_TCA,
-    PAPI_L3_TCA,
-    PAPI_L2_TCR,
-    PAPI_L3_TCR,
-    PAPI_L2_TCW,
-    PAPI_L3_TCW,
-    
-    PAPI_SP_OPS,
-    PAPI_DP_OPS,
-    PAPI_VEC_SP,
-    PAPI_VEC_DP,
-    PAPI_REF_CYC
-};
-
+// The events counted with --multiplex and no --events or --event-file.
 // ./papi_avail | grep Yes | awk '{print $1}' | sed 's/$/&",/g' | sed 's/^/"&/g'
-static char *all_select_preset_events_name[] = {
+static const char* all_select_preset_events_name[] = {
     "PAPI_L1_DCM",
     "PAPI_L1_ICM",
     "PAPI_L2_DCM",
@@ -165,37 +106,12 @@ static char *all_select_preset_events_name[] = {
     "PAPI_REF_CYC"
 };
 
-static int select_preset_events[] = {
-
-
-
-    PAPI_FUL_ICY,
-    PAPI_FUL_CCY
-    
-};
-
-static char *select_preset_events_name[] = {
-
-
-    "PAPI_FUL_ICY",
-    "PAPI_FUL_CCY"
-};
-
-static int  EVENTS_NUM = sizeof(select_preset_events)/sizeof(select_preset_events[0]);
-
-//char *select_native_events[EVENTS_NUM];
+// The events counted when none are given on the command line.
+static const char* const kDefaultEvents = "PAPI_FUL_ICY,PAPI_FUL_CCY";
 
 // The value of argv[0] passed to main(). Used in error messages.
 static const char* gArgv0;
 
-// A special value that represents an estimate from an unsupported RAPL domain.
-static const double kUnsupported_j = -1.0;
-
-FILE *fp;
-struct timeval tv;//前后两次采样时间值
-struct tm* pt;
-time_t itime;
-
 static void
 Abort(const char* aFormat, ...)
 {
@@ -209,375 +125,2718 @@ Abort(const char* aFormat, ...)
     exit(1);
 }
 
-// Print to stdout and flush it, so that the output appears immediately even if
-// being redirected through |tee| or anything like that.
-static void
-PrintAndFlush(const char* aFormat, ...)
-{
-    va_list vargs;
-    va_start(vargs, aFormat);
-    vfprintf(fp, aFormat, vargs);
-    va_end(vargs);
-
-    fflush(fp);
-}
-
-//---------------------------------------------------------------------------
-// Linux-specific code
-//---------------------------------------------------------------------------
+// Set from signal handlers to end the sampling loop early.
+static volatile sig_atomic_t gStop = 0;
 
-#include <linux/perf_event.h>
-#include <sys/syscall.h>
+// Set by SIGHUP to rotate the output files.
+static volatile sig_atomic_t gRotate = 0;
 
-// There is no glibc wrapper for this system call so we provide our own.
-static int
-perf_event_open(struct perf_event_attr* aAttr, pid_t aPid, int aCpu,
-                int aGroupFd, unsigned long aFlags)
+// Starts a helper thread with every signal blocked, so that signals are always
+// delivered to the sampling thread, where they cut its sleep short.
+static void
+StartThread(pthread_t* aThread, void* (*aMain)(void*), void* aArg)
 {
-    return syscall(__NR_perf_event_open, aAttr, aPid, aCpu, aGroupFd, aFlags);
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err = pthread_create(aThread, NULL, aMain, aArg);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0) {
+        Abort("pthread_create() failed: %s", strerror(err));
+    }
 }
 
-// Returns false if the file cannot be opened.
-template <typename T>
-static bool
-ReadValueFromPowerFile(const char* aStr1, const char* aStr2, const char* aStr3,
-                       const char* aScanfString, T* aOut)
+// The clock the sampler's own overhead is measured with. Unlike
+// CLOCK_MONOTONIC it isn't slewed by NTP, so short stages aren't stretched or
+// shrunk, and it is read through the vDSO in a few tens of ns.
+static int64_t
+RawNow_ns()
 {
-    // The filenames going into this buffer are under our control and the longest
-    // one is "/sys/bus/event_source/devices/power/events/energy-cores.scale".
-    // So 256 chars is plenty.
-    char filename[256];
-
-    sprintf(filename, "/sys/bus/event_source/devices/power/%s%s%s",
-            aStr1, aStr2, aStr3);
-    FILE* sysfp = fopen(filename, "r");
-    if (!sysfp) {
-        return false;
-    }
-    if (fscanf(sysfp, aScanfString, aOut) != 1) {
-        Abort("fscanf() failed");
-    }
-    fclose(sysfp);
-
-    return true;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
 }
 
-// This class encapsulates the reading of a single RAPL domain.
-class Domain
+// This class collects latencies for percentiles, in buckets a power of two
+// wide that are each split into kSubBuckets, so that a percentile is within
+// an eighth of the true value however spread out the latencies are. The max
+// is exact.
+class LatencyHistogram
 {
-    bool mIsSupported;      // Is the domain supported by the processor?
-
-    // These three are only set if |mIsSupported| is true.
-    double mJoulesPerTick;  // How many Joules each tick of the MSR represents.
-    int mFd;                // The fd through which the MSR is read.
-    double mPrevTicks;      // The previous sample's MSR value.
+    static const int kSubBits = 3;
+    static const int kSubBuckets = 1 << kSubBits;
 
-public:
-    enum IsOptional { Optional, NonOptional };
+    uint64_t mCounts[64 * kSubBuckets];
+    uint64_t mCount;
+    int64_t mMax_ns;
 
-    Domain(const char* aName, uint32_t aType, IsOptional aOptional = NonOptional)
+    static int Bucket(int64_t aValue)
     {
-        uint64_t config;
-        if (!ReadValueFromPowerFile("events/energy-", aName, "", "event=%llx",
-                                    &config)) {
-            // Failure is allowed for optional domains.
-            if (aOptional == NonOptional) {
-                Abort("failed to open file for non-optional domain '%s'\n"
-                      "- Is your kernel version 3.14 or later, as required? "
-                      "Run |uname -r| to see.", aName);
-            }
-            mIsSupported = false;
-            return;
-        }
-
-        mIsSupported = true;
-
-        ReadValueFromPowerFile("events/energy-", aName, ".scale", "%lf",
-                               &mJoulesPerTick);
-
-        // The unit should be "Joules", so 128 chars should be plenty.
-        char unit[128];
-        ReadValueFromPowerFile("events/energy-", aName, ".unit", "%127s", unit);
-        if (strcmp(unit, "Joules") != 0) {
-            Abort("unexpected unit '%s' in .unit file", unit);
+        if (aValue < kSubBuckets) {
+            return int(aValue);
         }
+        int shift = 63 - __builtin_clzll(aValue) - kSubBits;
+        return ((shift + 1) << kSubBits) + int((aValue >> shift) & (kSubBuckets - 1));
+    }
 
-        struct perf_event_attr attr;
-        memset(&attr, 0, sizeof(attr));
-        attr.type = aType;
-        attr.size = uint32_t(sizeof(attr));
-        attr.config = config;
-
-        // Measure all processes/threads. The specified CPU doesn't matter.
-        // need to special a pid?
-        mFd = perf_event_open(&attr, /* pid = */ -1, /* cpu = */ 0,
-                              /* group_fd = */ -1, /* flags = */ 0);
-        if (mFd < 0) {
-            Abort("perf_event_open() failed\n"
-                  "- Did you run as root (e.g. with |sudo|) or set\n"
-                  "  /proc/sys/kernel/perf_event_paranoid to 0, as required?");
+    // The largest value that falls in |aBucket|.
+    static int64_t BucketTop(int aBucket)
+    {
+        if (aBucket < kSubBuckets) {
+            return aBucket;
         }
+        int shift = (aBucket >> kSubBits) - 1;
+        int64_t base = int64_t(kSubBuckets + (aBucket & (kSubBuckets - 1))) << shift;
+        return base + (int64_t(1) << shift) - 1;
+    }
 
-        mPrevTicks = 0;
+public:
+    LatencyHistogram()
+      : mCount(0), mMax_ns(0)
+    {
+        memset(mCounts, 0, sizeof(mCounts));
     }
 
-    ~Domain()
+    void Add(int64_t aLatency_ns)
     {
-        if (mIsSupported) {
-            close(mFd);
+        if (aLatency_ns < 0) {
+            aLatency_ns = 0;
+        }
+        mCounts[Bucket(aLatency_ns)]++;
+        mCount++;
+        if (aLatency_ns > mMax_ns) {
+            mMax_ns = aLatency_ns;
         }
     }
 
-    double EnergyEstimate()
+    uint64_t Count() const { return mCount; }
+
+    // The latency that |aFraction| of them were no longer than.
+    int64_t Percentile(double aFraction) const
     {
-        if (!mIsSupported) {
-            return kUnsupported_j;
+        uint64_t rank = uint64_t(ceil(aFraction * mCount));
+        uint64_t seen = 0;
+        for (int i = 0; i < 64 * kSubBuckets; i++) {
+            seen += mCounts[i];
+            if (seen >= rank && seen > 0) {
+                int64_t top = BucketTop(i);
+                return top < mMax_ns ? top : mMax_ns;
+            }
         }
+        return mMax_ns;
+    }
 
-        uint64_t thisTicks;
-        if (read(mFd, &thisTicks, sizeof(uint64_t)) != sizeof(uint64_t)) {
-            Abort("read() failed");
+    // Prints one line, like "papi read: p50 3.1 us, p99 9.0 us, max 12.0 us".
+    void Print(FILE* aOut, const char* aStage) const
+    {
+        if (mCount == 0) {
+            return;
         }
-
-        uint64_t ticks = thisTicks - mPrevTicks;
-        mPrevTicks = thisTicks;
-        double joules = ticks * mJoulesPerTick;
-        return joules;
+        fprintf(aOut, "overhead: %-14s p50 %8.1f us, p99 %8.1f us, "
+                "max %8.1f us, %llu times\n", aStage, Percentile(0.5) / 1e3,
+                Percentile(0.99) / 1e3, mMax_ns / 1e3,
+                (unsigned long long)mCount);
     }
 };
 
-class RAPL
+// This class schedules samples on absolute CLOCK_MONOTONIC deadlines, so the
+// time spent reading and printing a sample doesn't stretch the sample period,
+// and measures how long each period really was.
+class IntervalTimer
 {
-    // PKG: The entire package.
-    Domain* mPkg;
-    // PP0
-    Domain* mCores;
-    // client only PP1
-    Domain* mGpu;
-    Domain* mRam;
+    int64_t mInterval_ns;   // The nominal sample interval.
+    int64_t mDeadline_ns;   // The next absolute deadline.
+    int64_t mPrev_ns;       // When the previous sample was taken.
+
+    // Statistics, reported by PrintStats().
+    uint64_t mPeriods;      // Number of measured periods.
+    uint64_t mOverruns;     // Periods whose deadline had already passed.
+    uint64_t mMissed;       // Deadlines skipped entirely because of overruns.
+    double mLatencySum_ns;  // Wakeup latency (wakeup time - deadline).
+    double mLatencySumSq_ns;
+    int64_t mLatencyMax_ns;
+    int64_t mPeriodMin_ns;
+    int64_t mPeriodMax_ns;
 
 public:
-    RAPL()
+    explicit IntervalTimer(int aInterval_msec)
+      : mInterval_ns(int64_t(aInterval_msec) * 1000000)
+      , mDeadline_ns(0), mPrev_ns(0)
+      , mPeriods(0), mOverruns(0), mMissed(0)
+      , mLatencySum_ns(0), mLatencySumSq_ns(0), mLatencyMax_ns(0)
+      , mPeriodMin_ns(INT64_MAX), mPeriodMax_ns(0)
+    {}
+
+    // The first Wait() after this returns immediately.
+    void Start()
     {
-        uint32_t type;
-        ReadValueFromPowerFile("type", "", "", "%u", &type);
-
-        mPkg   = new Domain("pkg",   type);
-        mCores = new Domain("cores", type);
-        mGpu   = new Domain("gpu",   type, Domain::Optional);
-        mRam   = new Domain("ram",   type, Domain::Optional);
-        if (!mPkg || !mCores || !mGpu || !mRam) {
-            Abort("new Domain() failed");
-        }
+        mPrev_ns = mDeadline_ns = MonotonicNow_ns();
     }
 
-    ~RAPL()
+    // Sleeps until the next deadline, or until a signal sets gStop, and
+    // returns the measured length, in nanoseconds, of the period that just
+    // ended. If the deadline has already passed it returns immediately, and
+    // the following deadline is moved past any periods that were missed
+    // rather than trying to catch up.
+    //
+    // The signals that set gStop are blocked from the check of gStop until
+    // ppoll() atomically unblocks them, so one that arrives in between
+    // interrupts the sleep instead of being noticed a whole period late.
+    int64_t Wait()
     {
-        delete mPkg;
-        delete mCores;
-        delete mGpu;
-        delete mRam;
+        bool isFirst = mPrev_ns == mDeadline_ns;
+        sigset_t stopSignals, old;
+        sigemptyset(&stopSignals);
+        sigaddset(&stopSignals, SIGINT);
+        sigaddset(&stopSignals, SIGTERM);
+        sigaddset(&stopSignals, SIGCHLD);
+        pthread_sigmask(SIG_BLOCK, &stopSignals, &old);
+        int64_t now_ns = MonotonicNow_ns();
+        if (now_ns < mDeadline_ns) {
+            while (!gStop && now_ns < mDeadline_ns) {
+                int64_t left_ns = mDeadline_ns - now_ns;
+                struct timespec timeout;
+                timeout.tv_sec  = left_ns / 1000000000;
+                timeout.tv_nsec = left_ns % 1000000000;
+                if (ppoll(NULL, 0, &timeout, &old) < 0 && errno != EINTR) {
+                    Abort("ppoll() failed: %s", strerror(errno));
+                }
+                now_ns = MonotonicNow_ns();
+            }
+        } else if (!isFirst) {
+            mOverruns++;
+        }
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+        // A period cut short by gStop doesn't count towards the statistics.
+        int64_t period_ns = now_ns - mPrev_ns;
+        if (!isFirst && now_ns >= mDeadline_ns) {
+            int64_t latency_ns = now_ns - mDeadline_ns;
+            mPeriods++;
+            mLatencySum_ns   += latency_ns;
+            mLatencySumSq_ns += double(latency_ns) * latency_ns;
+            if (latency_ns > mLatencyMax_ns) mLatencyMax_ns = latency_ns;
+            if (period_ns < mPeriodMin_ns)   mPeriodMin_ns  = period_ns;
+            if (period_ns > mPeriodMax_ns)   mPeriodMax_ns  = period_ns;
+        }
+
+        mDeadline_ns += mInterval_ns;
+        if (mDeadline_ns <= now_ns) {
+            int64_t missed = (now_ns - mDeadline_ns) / mInterval_ns + 1;
+            mMissed += missed;
+            mDeadline_ns += missed * mInterval_ns;
+        }
+        mPrev_ns = now_ns;
+
+        return period_ns;
     }
 
-    void EnergyEstimates(double& aPkg_J, double& aCores_J, double& aGpu_J,
-                         double& aRam_J)
+    void PrintStats(FILE* aOut) const
     {
-        aPkg_J   = mPkg->EnergyEstimate();
-        aCores_J = mCores->EnergyEstimate();
-        aGpu_J   = mGpu->EnergyEstimate();
-        aRam_J   = mRam->EnergyEstimate();
+        if (mPeriods == 0) {
+            return;
+        }
+        double mean_ns = mLatencySum_ns / mPeriods;
+        double var_ns = mLatencySumSq_ns / mPeriods - mean_ns * mean_ns;
+        fprintf(aOut,
+                "sampler: %llu periods of %.3f ms, measured %.3f..%.3f ms\n"
+                "sampler: wakeup jitter mean %.1f us, stddev %.1f us, "
+                "max %.1f us\n"
+                "sampler: %llu overruns, %llu deadlines missed\n",
+                (unsigned long long)mPeriods, mInterval_ns / 1e6,
+                mPeriodMin_ns / 1e6, mPeriodMax_ns / 1e6,
+                mean_ns / 1e3, sqrt(var_ns > 0 ? var_ns : 0) / 1e3,
+                mLatencyMax_ns / 1e3,
+                (unsigned long long)mOverruns, (unsigned long long)mMissed);
     }
 };
 
-
-// The sample interval, measured in seconds.
-static double gSampleInterval_sec = double(sampleInterval_msec) / 1000;
-
 // The platform-specific RAPL-reading machinery.
 static RAPL* gRapl;
 
+// RAPL is set up on a thread of its own while PAPI initializes, since neither
+// needs the other and PAPI takes a while.
+struct RaplSetup
+{
+    RAPL::Backend mBackend;
+    int64_t mTime_ns;               // How long it took.
+};
+
+static void*
+SetUpRapl(void* aArg)
+{
+    RaplSetup* setup = static_cast<RaplSetup*>(aArg);
+    int64_t start_ns = MonotonicNow_ns();
+    gRapl = new RAPL(setup->mBackend);
+    setup->mTime_ns = MonotonicNow_ns() - start_ns;
+    return NULL;
+}
+
 // Power = Energy / Time, where power is measured in Watts, Energy is measured
-// in Joules, and Time is measured in seconds.
+// in Joules, and Time is measured in seconds. |aInterval_sec| is the measured
+// length of the sample period, not the nominal interval.
 static double
-JoulesToWatts(double aJoules)
+JoulesToWatts(double aJoules, double aInterval_sec)
 {
-    return aJoules / gSampleInterval_sec;
+    return aJoules / aInterval_sec;
 }
 
 // "Normalize" here means convert kUnsupported_j to zero so it can be used in
 // additive expressions. All printed values are 5 or maybe 6 chars (though 6
 // chars would require a value > 100 W, which is unlikely).
 static void
-NormalizeAndPrintAsWatts(char* aBuf, double& aValue_J)
+NormalizeAndPrintAsWatts(char* aBuf, double& aValue_J, double aInterval_sec)
 {
     if (aValue_J == kUnsupported_j) {
         aValue_J = 0;
         sprintf(aBuf, "%s", " n/a ");
     } else {
-        sprintf(aBuf, "%5.2f", JoulesToWatts(aValue_J));
+        sprintf(aBuf, "%5.2f", JoulesToWatts(aValue_J, aInterval_sec));
     }
 }
 
-int
-main()
-{
-
-//     if(EVENTS_NUM >= MAX_ADD_EVENTS) {
-//         Abort("EVENTS_NUM >= MAX_ADD_EVENTS");
-//     }
-    /*
-     *   To free pagecache:
-     *      echo 1 > /proc/sys/vm/drop_caches
-     *   To free reclaimable slab objects (includes dentries and inodes):
-     *       echo 2 > /proc/sys/vm/drop_caches
-     *   To free slab objects and pagecache:
-     *       echo 3 > /proc/sys/vm/drop_caches
-     */
-    char string[] ="sync && echo 3 > /proc/sys/vm/drop_caches && sleep 2 \
-             && echo 1 > /proc/sys/vm/drop_caches \
-             && echo 2 > /proc/sys/vm/drop_caches";
-    system(string); //清除系统缓存
+//---------------------------------------------------------------------------
+// Output
+//---------------------------------------------------------------------------
 
-    char filename[256];
-    itime = time(NULL);
-    pt = localtime(&itime);
-    sprintf(filename, "util-power-%d-%d.csv", pt->tm_hour, pt->tm_min);
-    if((fp = fopen(filename, "ab")) == NULL)
-    {
-        perror("file open failed!");
-        exit(EXIT_FAILURE);
-    }
+// Everything needed to interpret a stream of Samples. It is written once at
+// the start of each output file.
+struct SampleLayout
+{
+    int mInterval_msec;
+    int mNumEvents;
+    char mEventNames[kMaxEvents][kMaxEventNameLen];
+    bool mHasScales;                // Does each event have a scale column?
+    bool mHasOverhead;              // Is there an overhead column? CSV only.
+    int mNumSockets;
+    double mJoulesPerTick[kMaxSockets][kNumDomains];    // 0 if unsupported.
+};
+
+// One sample: raw counter deltas and RAPL ticks, converted to watts only when
+// they are formatted.
+struct Sample
+{
+    int64_t mTime_usec;             // Wall-clock time, since the epoch.
+    int64_t mInterval_ns;           // Measured length of the sampler period.
+    long_long mValues[kMaxEvents];  // Counter deltas over the period.
+    double mScales[kMaxEvents];     // Only if the layout has scales.
+    PackageSample mPackages[kMaxSockets];
+    int64_t mOverhead_ns;           // The sampler's time taking the sample.
+    uint64_t mSeq;                  // Numbered by the sampler, so that samples
+                                    // a ring drops leave a gap.
+
+    // These are only set in per-thread samples, which also carry the
+    // machine-wide RAPL ticks of the sample they belong to.
+    int32_t mTid;
+    char mComm[16];
+    double mCycleShare;             // The thread's share of all PAPI_TOT_CYC.
+};
 
+// Prints the pp0,pp1,pkg,ram power columns for one set of estimates.
+static void
+PrintPowerColumns(FILE* aOut, double aPkg_J, double aCores_J, double aGpu_J,
+                  double aRam_J, double aInterval_sec)
+{
+    // This needs to be big enough to print watt values to two decimal places. 16
+    // should be plenty.
+    static const size_t kNumStrLen = 16;
+
+    char pkgStr[kNumStrLen], coresStr[kNumStrLen], gpuStr[kNumStrLen],
+         ramStr[kNumStrLen];
+    NormalizeAndPrintAsWatts(pkgStr,   aPkg_J,   aInterval_sec);
+    NormalizeAndPrintAsWatts(coresStr, aCores_J, aInterval_sec);
+    NormalizeAndPrintAsWatts(gpuStr,   aGpu_J,   aInterval_sec);
+    NormalizeAndPrintAsWatts(ramStr,   aRam_J,   aInterval_sec);
+
+    fprintf(aOut, "%s,%s,%s,%s", coresStr, gpuStr, pkgStr, ramStr);
+}
 
-    int retval, EventSet = PAPI_NULL;
-    unsigned int native = 0x0;
+static void
+WriteCsvHeader(FILE* aOut, const SampleLayout& aLayout)
+{
+    fprintf(aOut, "timestamp,");
+    for (int i = 0; i < aLayout.mNumEvents; i++) {
+        fprintf(aOut, "%s,", aLayout.mEventNames[i]);
+        if (aLayout.mHasScales) {
+            fprintf(aOut, "%s:scale,", aLayout.mEventNames[i]);
+        }
+    }
+    // With more than one socket each one gets its own columns, followed by the
+    // machine totals under the usual names.
+    if (aLayout.mNumSockets > 1) {
+        for (int i = 0; i < aLayout.mNumSockets; i++) {
+            fprintf(aOut, "pp0-power-s%d,pp1-power-s%d,pkg-power-s%d,"
+                          "ram-power-s%d,", i, i, i, i);
+        }
+    }
+    fprintf(aOut, "pp0-power,pp1-power,pkg-power,ram-power%s\n",
+            aLayout.mHasOverhead ? ",overhead-us" : "");
+}
 
-    /* Initialize the PAPI library */
-    if((PAPI_library_init(PAPI_VER_CURRENT)) != PAPI_VER_CURRENT ) {
-        Abort("PAPI failed to init.\n");
+// Converts a sample's RAPL ticks to Joules per socket, with the window each
+// socket's ticks cover, and to machine totals.
+//
+// For the machine totals each package's energy is rescaled to the sampler's
+// period first, so that the totals are the sum of the per-socket watts.
+static void
+ComputeEnergy(const SampleLayout& aLayout, const Sample& aSample,
+              double aEnergy_J[kMaxSockets][kNumDomains],
+              double aWindow_sec[kMaxSockets], double aTotal_J[kNumDomains])
+{
+    double interval_sec = aSample.mInterval_ns / 1e9;
+    for (int d = 0; d < kNumDomains; d++) {
+        aTotal_J[d] = kUnsupported_j;
+    }
+    for (int i = 0; i < aLayout.mNumSockets; i++) {
+        const PackageSample& package = aSample.mPackages[i];
+        aWindow_sec[i] = package.mWindow_ns / 1e9;
+        for (int d = 0; d < kNumDomains; d++) {
+            double joulesPerTick = aLayout.mJoulesPerTick[i][d];
+            aEnergy_J[i][d] = joulesPerTick == 0 ? kUnsupported_j
+                                                 : package.mTicks[d] * joulesPerTick;
+            if (aEnergy_J[i][d] != kUnsupported_j && aWindow_sec[i] > 0) {
+                AccumulateEstimate(aTotal_J[d], aEnergy_J[i][d] *
+                                   interval_sec / aWindow_sec[i]);
+            }
+        }
+        // We should have pkg and cores estimates, but might not have gpu and
+        // ram estimates.
+        assert(aEnergy_J[i][kPkg]   != kUnsupported_j);
+        assert(aEnergy_J[i][kCores] != kUnsupported_j);
     }
+}
+
+static void
+WriteCsvTimestamp(FILE* aOut, int64_t aTime_usec)
+{
+    time_t time_sec = time_t(aTime_usec / 1000000);
+    struct tm* pt = localtime(&time_sec);
+    int cur_millisec = int(aTime_usec % 1000000) / 1000;
+    fprintf(aOut, "%d:%d:%d.%d,", pt->tm_hour, pt->tm_min, pt->tm_sec,
+            cur_millisec);
+}
 
-    /* Create an EventSet */
-    EventSet = PAPI_NULL;
-    if (PAPI_create_eventset(&EventSet) != PAPI_OK) {
-        Abort("PAPI failed to create the event set.\n");
+static void
+WriteCsvRow(FILE* aOut, const SampleLayout& aLayout, const Sample& aSample)
+{
+    double interval_sec = aSample.mInterval_ns / 1e9;
+
+    // Each package's power is computed over the window its ticks cover.
+    double energy_J[kMaxSockets][kNumDomains], window_sec[kMaxSockets];
+    double total_J[kNumDomains];
+    ComputeEnergy(aLayout, aSample, energy_J, window_sec, total_J);
+
+    WriteCsvTimestamp(aOut, aSample.mTime_usec);
+    for (int i = 0; i < aLayout.mNumEvents; i++) {
+        fprintf(aOut, "%lld,", aSample.mValues[i]);
+        if (aLayout.mHasScales) {
+            fprintf(aOut, "%.3f,", aSample.mScales[i]);
+        }
     }
+    if (aLayout.mNumSockets > 1) {
+        for (int i = 0; i < aLayout.mNumSockets; i++) {
+            PrintPowerColumns(aOut, energy_J[i][kPkg], energy_J[i][kCores],
+                              energy_J[i][kGpu], energy_J[i][kRam],
+                              window_sec[i]);
+            fprintf(aOut, ",");
+        }
+    }
+    PrintPowerColumns(aOut, total_J[kPkg], total_J[kCores], total_J[kGpu],
+                      total_J[kRam], interval_sec);
+    if (aLayout.mHasOverhead) {
+        fprintf(aOut, ",%.1f", aSample.mOverhead_ns / 1e3);
+    }
+    fprintf(aOut, "\n");
+}
+
+// Output files are rotated on SIGHUP, and when they reach --rotate-size bytes
+// or have been open for --rotate-time. The live file always has the name it
+// was given, and a rotated one is renamed NAME.YYYYMMDD-HHMMSS and, with
+// --compress, gzipped in the background.
+static int64_t gRotateSize = 0;         // Zero for no limit.
+static int64_t gRotateTime_ns = 0;      // Zero for no limit.
+static bool gCompress = false;
+
+// The most gzips left running at once. Starting another waits for the oldest.
+static const int kMaxCompressors = 8;
+
+// This class keeps track of when an output file is due for rotation, and
+// retires the files it closes.
+class Segments
+{
+    char mPath[PATH_MAX];
+    int64_t mOpened_ns;
+    pid_t mCompressors[kMaxCompressors];
+    int mNumCompressors;
 
-    for(int i = 0; i < EVENTS_NUM; i++) {
-        if(PAPI_query_event(select_preset_events[i]) == PAPI_OK) {
-            if(PAPI_add_event(EventSet, select_preset_events[i]) != PAPI_OK) {
-                printf("PAPI_add_event %s error! \n", select_preset_events_name[i]);
+    // Collects the gzips that have finished, or waits for all of them.
+    void Reap(bool aWait)
+    {
+        int n = 0;
+        for (int i = 0; i < mNumCompressors; i++) {
+            int status;
+            pid_t pid = waitpid(mCompressors[i], &status, aWait ? 0 : WNOHANG);
+            if (pid == 0) {
+                mCompressors[n++] = mCompressors[i];
+                continue;
+            }
+            if (pid > 0 && !(WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+                fprintf(stderr, "%s: gzip of a rotated %s failed\n", gArgv0,
+                        mPath);
             }
-        } else {
-            printf("PAPI_query_event %s error! \n", select_preset_events_name[i]);
         }
+        mNumCompressors = n;
     }
 
-    if (PAPI_start(EventSet) != PAPI_OK) {
-        Abort("PAPI_start error! \n");
+    void Compress(const char* aPath)
+    {
+        Reap(false);
+        if (mNumCompressors == kMaxCompressors) {
+            waitpid(mCompressors[0], NULL, 0);
+            memmove(mCompressors, mCompressors + 1,
+                    --mNumCompressors * sizeof(mCompressors[0]));
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            fprintf(stderr, "%s: fork() failed, leaving %s uncompressed: %s\n",
+                    gArgv0, aPath, strerror(errno));
+            return;
+        }
+        if (pid == 0) {
+            // In a process group of its own, so that a Ctrl-C meant for us
+            // doesn't cut it short; we wait for it before exiting anyway.
+            // This thread has every signal blocked, and gzip shouldn't.
+            setpgid(0, 0);
+            sigset_t none;
+            sigemptyset(&none);
+            sigprocmask(SIG_SETMASK, &none, NULL);
+            execlp("gzip", "gzip", "-f", "--", aPath, (char*)NULL);
+            _exit(127);
+        }
+        mCompressors[mNumCompressors++] = pid;
     }
 
-    // The RAPL MSRs update every ~1 ms, but the measurement period isn't exactly
-    // 1 ms, which means the sample periods are not exact. "Power Measurement
-    // Techniques on Standard Compute Nodes: A Quantitative Comparison" by
-    // Hackenberg et al. suggests the following.
-    //
-    //   "RAPL provides energy (and not power) consumption data without
-    //   timestamps associated to each counter update. This makes sampling rates
-    //   above 20 Samples/s unfeasible if the systematic error should be below
-    //   5%... Constantly polling the RAPL registers will both occupy a processor
-    //   core and distort the measurement itself."
-    //
-    // So warn about this case.
-    //sampleInterval_msec = sampleInterval_msec/2;
-    if (sampleInterval_msec < 50) {
-        fprintf(stderr,
-                "\nWARNING: sample intervals < 50 ms are likely to produce "
-                "inaccurate estimates\n\n");
+    static bool Exists(const char* aPath)
+    {
+        char gz[PATH_MAX + 64];
+        snprintf(gz, sizeof(gz), "%s.gz", aPath);
+        return access(aPath, F_OK) == 0 || access(gz, F_OK) == 0;
     }
 
-    // Initialize the platform-specific RAPL reading machinery.
-    gRapl = new RAPL();
+public:
+    explicit Segments(const char* aPath)
+      : mOpened_ns(0), mNumCompressors(0)
+    {
+        snprintf(mPath, sizeof(mPath), "%s", aPath);
+    }
 
-    PrintAndFlush("timestamp,");
-    for (int i=0; i < EVENTS_NUM; i++) {
-        PrintAndFlush("%s,",select_preset_events_name[i]);
+    ~Segments()
+    {
+        Reap(true);
     }
-    PrintAndFlush("pp0-power,pp1-power,pkg-power,ram-power\n");
 
-    int accu = 0;
-    while(true) {
+    const char* Path() const { return mPath; }
+
+    // Called when the live file is opened.
+    void Opened() { mOpened_ns = MonotonicNow_ns(); }
+
+    // Is the live file, which is |aSize| bytes long, due for rotation?
+    bool IsFull(int64_t aSize) const
+    {
+        return (gRotateSize > 0 && aSize >= gRotateSize) ||
+               (gRotateTime_ns > 0 &&
+                MonotonicNow_ns() - mOpened_ns >= gRotateTime_ns);
+    }
 
-        if (PAPI_reset(EventSet) != PAPI_OK) {
-            Abort("PAPI_reset error! \n");
+    // Renames the live file, which must be closed, and compresses it.
+    void Retire()
+    {
+        time_t now = time(NULL);
+        struct tm tm;
+        localtime_r(&now, &tm);
+        char stamp[32];
+        strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+
+        // Rotating twice in a second needs another name.
+        char name[PATH_MAX + 48];
+        snprintf(name, sizeof(name), "%s.%s", mPath, stamp);
+        for (int n = 1; Exists(name); n++) {
+            snprintf(name, sizeof(name), "%s.%s.%d", mPath, stamp, n);
+        }
+        if (rename(mPath, name) != 0) {
+            Abort("failed to rename %s to %s: %s", mPath, name,
+                  strerror(errno));
+        }
+        if (gCompress) {
+            Compress(name);
         }
+    }
+};
+
+// The interface to the formats samples can be written in. Outputs are only
+// used from their writer thread.
+class Output
+{
+public:
+    // How long samples took to format, and to write out, on the writer
+    // thread. Read once the writer has stopped.
+    LatencyHistogram mFormatTimes;
+    LatencyHistogram mWriteTimes;
 
-        gettimeofday (&tv, NULL);
-        itime = time(NULL);//从1970年－1-1零点零分到当前系统所偏移的秒数
-        pt = localtime(&itime);//将从1970－1-1零点零分到当前时间系统所偏移的秒数时间转换为本地时间
-        int cur_millisec = tv.tv_usec/1000;
+    virtual ~Output() {}
 
-        // impossible exceed 128
-        long_long values[128] = {0};
-        /* Read counters */
-        if (PAPI_read(EventSet, values) != PAPI_OK) {
-            Abort("PAPI_read error! \n");
+    virtual void Write(const Sample& aSample) = 0;
+
+    // Starts a new file, for the outputs that write to one.
+    virtual void Rotate() {}
+};
+
+// This class writes samples as CSV rows, flushing each one so that the output
+// appears immediately even if being redirected through |tee| or anything like
+// that.
+class CsvOutput : public Output
+{
+    FILE* mFile;
+    const SampleLayout& mLayout;
+    Segments mSegments;
+
+    void Open()
+    {
+        if ((mFile = fopen(mSegments.Path(), "ab")) == NULL) {
+            Abort("failed to open %s: %s", mSegments.Path(), strerror(errno));
         }
+        mSegments.Opened();
+        WriteCsvHeader(mFile, mLayout);
+        fflush(mFile);
+    }
+
+public:
+    CsvOutput(const char* aFilename, const SampleLayout& aLayout)
+      : mLayout(aLayout), mSegments(aFilename)
+    {
+        Open();
+    }
+
+    ~CsvOutput()
+    {
+        fclose(mFile);
+    }
 
-        double pkg_J, cores_J, gpu_J, ram_J;
-        gRapl->EnergyEstimates(pkg_J, cores_J, gpu_J, ram_J);
+    virtual void Write(const Sample& aSample)
+    {
+        int64_t start_ns = RawNow_ns();
+        WriteCsvRow(mFile, mLayout, aSample);
+        int64_t formatted_ns = RawNow_ns();
+        fflush(mFile);
+        mFormatTimes.Add(formatted_ns - start_ns);
+        mWriteTimes.Add(RawNow_ns() - formatted_ns);
+        if (mSegments.IsFull(ftello(mFile))) {
+            Rotate();
+        }
+    }
 
-        // We should have pkg and cores estimates, but might not have gpu and ram
-        // estimates.
-        assert(pkg_J   != kUnsupported_j);
-        assert(cores_J != kUnsupported_j);
+    virtual void Rotate()
+    {
+        fclose(mFile);
+        mSegments.Retire();
+        Open();
+    }
+};
 
-        // This needs to be big enough to print watt values to two decimal places. 16
-        // should be plenty.
-        static const size_t kNumStrLen = 16;
+// This class writes per-thread samples as CSV rows. Each row has a thread's
+// counts and its share of the machine's power, split in proportion to its
+// share of the PAPI_TOT_CYC of all the threads counted.
+class ThreadCsvOutput : public Output
+{
+    FILE* mFile;
+    const SampleLayout& mLayout;
+    Segments mSegments;
 
-        static char pkgStr[kNumStrLen], coresStr[kNumStrLen], gpuStr[kNumStrLen],
-               ramStr[kNumStrLen];
-        NormalizeAndPrintAsWatts(pkgStr,   pkg_J);
-        NormalizeAndPrintAsWatts(coresStr, cores_J);
-        NormalizeAndPrintAsWatts(gpuStr,   gpu_J);
-        NormalizeAndPrintAsWatts(ramStr,   ram_J);
+    void Open()
+    {
+        if ((mFile = fopen(mSegments.Path(), "ab")) == NULL) {
+            Abort("failed to open %s: %s", mSegments.Path(), strerror(errno));
+        }
+        mSegments.Opened();
+        fprintf(mFile, "timestamp,tid,comm,");
+        for (int i = 0; i < mLayout.mNumEvents; i++) {
+            fprintf(mFile, "%s,", mLayout.mEventNames[i]);
+        }
+        fprintf(mFile, "cycle-share,pp0-power,pp1-power,pkg-power,ram-power\n");
+        fflush(mFile);
+    }
 
-        char otherStr[kNumStrLen];
-        double other_J = pkg_J - cores_J - gpu_J;
-        NormalizeAndPrintAsWatts(otherStr, other_J);
+public:
+    ThreadCsvOutput(const char* aFilename, const SampleLayout& aLayout)
+      : mLayout(aLayout), mSegments(aFilename)
+    {
+        Open();
+    }
 
-        char totalStr[kNumStrLen];
-        double total_J = pkg_J + ram_J;
-        NormalizeAndPrintAsWatts(totalStr, total_J);
+    ~ThreadCsvOutput()
+    {
+        fclose(mFile);
+    }
 
-        //fix the first power records all are 0
-        if (accu > 0) {
-            PrintAndFlush("%d:%d:%d.%d,", pt->tm_hour,pt->tm_min,pt->tm_sec,cur_millisec);
-            for(int i = 0; i < EVENTS_NUM; i++) {
-                PrintAndFlush("%lld,",values[i]);
+    virtual void Write(const Sample& aSample)
+    {
+        int64_t start_ns = RawNow_ns();
+        double energy_J[kMaxSockets][kNumDomains], window_sec[kMaxSockets];
+        double total_J[kNumDomains];
+        ComputeEnergy(mLayout, aSample, energy_J, window_sec, total_J);
+        for (int d = 0; d < kNumDomains; d++) {
+            if (total_J[d] != kUnsupported_j) {
+                total_J[d] *= aSample.mCycleShare;
             }
-            PrintAndFlush("%s,%s,%s,%s\n",coresStr,gpuStr,pkgStr,ramStr);
         }
 
-        usleep(sampleInterval_msec * 1000);
+        WriteCsvTimestamp(mFile, aSample.mTime_usec);
+        fprintf(mFile, "%d,%s,", int(aSample.mTid), aSample.mComm);
+        for (int i = 0; i < mLayout.mNumEvents; i++) {
+            fprintf(mFile, "%lld,", aSample.mValues[i]);
+        }
+        fprintf(mFile, "%.4f,", aSample.mCycleShare);
+        PrintPowerColumns(mFile, total_J[kPkg], total_J[kCores], total_J[kGpu],
+                          total_J[kRam], aSample.mInterval_ns / 1e9);
+        fprintf(mFile, "\n");
+        int64_t formatted_ns = RawNow_ns();
+        fflush(mFile);
+        mFormatTimes.Add(formatted_ns - start_ns);
+        mWriteTimes.Add(RawNow_ns() - formatted_ns);
+        if (mSegments.IsFull(ftello(mFile))) {
+            Rotate();
+        }
+    }
+
+    virtual void Rotate()
+    {
+        fclose(mFile);
+        mSegments.Retire();
+        Open();
+    }
+};
 
-        if(accu >= sampleCount) {
-            if (PAPI_stop(EventSet, values) != PAPI_OK) {
-                Abort("PAPI_stop error \n");
+// The binary format is a header followed by batches of fixed-size records,
+// with every field little-endian:
+//
+//   header:  char     magic[8]                "rp_t2bin"
+//            uint32   version, interval_msec, num_events, num_sockets
+//            uint32   flags                   version 2 and later
+//            char     event_names[num_events][kMaxEventNameLen]
+//            float64  joules_per_tick[num_sockets][kNumDomains]
+//   batch:   uint32   num_records             version 3 and later
+//            record   records[num_records]
+//   record:  uint64   time_usec, interval_ns
+//            int64    values[num_events]
+//            float64  scales[num_events]      if kBinaryHasScales
+//            uint64   { window_ns, ticks[kNumDomains] }[num_sockets]
+//
+// Files opened in append mode can hold several segments, each a header and
+// its batches, so another header can start wherever a batch could. It is told
+// apart from one by its magic, whose first four bytes, read as num_records,
+// are far above kMaxBatch. Versions 1 and 2 have no batch counts, so there a
+// record that happened to start with the magic would be taken for a header.
+static const char kBinaryMagic[8] = { 'r', 'p', '_', 't', '2', 'b', 'i', 'n' };
+static const uint32_t kBinaryVersion = 3;
+static const uint32_t kBinaryHasScales = 0x1;
+static const int kMaxBatch = 65536;
+
+static uint8_t*
+PutLE(uint8_t* aBuf, uint64_t aValue, int aBytes)
+{
+    for (int i = 0; i < aBytes; i++) {
+        aBuf[i] = uint8_t(aValue >> (8 * i));
+    }
+    return aBuf + aBytes;
+}
+
+static uint64_t
+GetLE(const uint8_t* aBuf, int aBytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < aBytes; i++) {
+        value |= uint64_t(aBuf[i]) << (8 * i);
+    }
+    return value;
+}
+
+static size_t
+BinaryHeaderSize(const SampleLayout& aLayout)
+{
+    return sizeof(kBinaryMagic) + 5 * 4 + aLayout.mNumEvents * kMaxEventNameLen +
+           aLayout.mNumSockets * kNumDomains * 8;
+}
+
+static size_t
+BinaryRecordSize(const SampleLayout& aLayout)
+{
+    return 2 * 8 + aLayout.mNumEvents * (aLayout.mHasScales ? 16 : 8) +
+           aLayout.mNumSockets * (1 + kNumDomains) * 8;
+}
+
+static uint8_t*
+PutDouble(uint8_t* aBuf, double aValue)
+{
+    uint64_t bits;
+    memcpy(&bits, &aValue, sizeof(bits));
+    return PutLE(aBuf, bits, 8);
+}
+
+static double
+GetDouble(const uint8_t* aBuf)
+{
+    uint64_t bits = GetLE(aBuf, 8);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// This class writes samples in the binary format into a preallocated buffer,
+// which is written out as one batch with a single write() every |aBatch|
+// samples.
+class BinaryOutput : public Output
+{
+    int mFd;
+    const SampleLayout& mLayout;
+    size_t mRecordSize;
+    int mBatch;
+    uint8_t* mBuf;
+    int mNumBuffered;
+    Segments mSegments;
+    int64_t mSize;                  // What has been written to the live file.
+
+    void WriteAll(const uint8_t* aBuf, size_t aSize)
+    {
+        mSize += aSize;
+        while (aSize > 0) {
+            ssize_t n = write(mFd, aBuf, aSize);
+            if (n < 0 && errno == EINTR) {
+                continue;
             }
-            if (PAPI_cleanup_eventset(EventSet) != PAPI_OK) {
-                Abort("PAPI_stop error \n");
+            if (n <= 0) {
+                Abort("write() failed: %s", strerror(errno));
             }
-            if (PAPI_destroy_eventset(&EventSet) != PAPI_OK) {
-                Abort("PAPI_stop error \n");
+            aBuf += n;
+            aSize -= n;
+        }
+    }
+
+    // Writes out the buffered records, after their count in the first four
+    // bytes of |mBuf|.
+    void Flush()
+    {
+        if (mNumBuffered == 0) {
+            return;
+        }
+        PutLE(mBuf, mNumBuffered, 4);
+        WriteAll(mBuf, 4 + mNumBuffered * mRecordSize);
+        mNumBuffered = 0;
+    }
+
+    // Opens the live file and writes the header, which |mBuf| must be free
+    // for.
+    void Open()
+    {
+        mFd = open(mSegments.Path(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (mFd < 0) {
+            Abort("failed to open %s: %s", mSegments.Path(), strerror(errno));
+        }
+        mSegments.Opened();
+        mSize = lseek(mFd, 0, SEEK_END);
+
+        uint8_t* p = mBuf;
+        memcpy(p, kBinaryMagic, sizeof(kBinaryMagic));
+        p += sizeof(kBinaryMagic);
+        p = PutLE(p, kBinaryVersion, 4);
+        p = PutLE(p, mLayout.mInterval_msec, 4);
+        p = PutLE(p, mLayout.mNumEvents, 4);
+        p = PutLE(p, mLayout.mNumSockets, 4);
+        p = PutLE(p, mLayout.mHasScales ? kBinaryHasScales : 0, 4);
+        for (int i = 0; i < mLayout.mNumEvents; i++) {
+            memset(p, 0, kMaxEventNameLen);
+            strncpy((char*)p, mLayout.mEventNames[i], kMaxEventNameLen - 1);
+            p += kMaxEventNameLen;
+        }
+        for (int i = 0; i < mLayout.mNumSockets; i++) {
+            for (int d = 0; d < kNumDomains; d++) {
+                p = PutDouble(p, mLayout.mJoulesPerTick[i][d]);
             }
-            PAPI_shutdown();
-            break;
         }
-        accu++;
+        WriteAll(mBuf, p - mBuf);
+    }
+
+public:
+    BinaryOutput(const char* aFilename, const SampleLayout& aLayout, int aBatch)
+      : mLayout(aLayout), mBatch(aBatch), mNumBuffered(0),
+        mSegments(aFilename)
+    {
+        mRecordSize = BinaryRecordSize(mLayout);
+        size_t headerSize = BinaryHeaderSize(mLayout);
+        size_t bufSize = 4 + mBatch * mRecordSize;
+        mBuf = (uint8_t*)malloc(bufSize > headerSize ? bufSize : headerSize);
+        if (!mBuf) {
+            Abort("malloc() failed");
+        }
+        Open();
+    }
+
+    ~BinaryOutput()
+    {
+        Flush();
+        free(mBuf);
+        close(mFd);
+    }
+
+    virtual void Write(const Sample& aSample)
+    {
+        int64_t start_ns = RawNow_ns();
+        uint8_t* p = mBuf + 4 + mNumBuffered * mRecordSize;
+        p = PutLE(p, aSample.mTime_usec, 8);
+        p = PutLE(p, aSample.mInterval_ns, 8);
+        for (int i = 0; i < mLayout.mNumEvents; i++) {
+            p = PutLE(p, aSample.mValues[i], 8);
+        }
+        if (mLayout.mHasScales) {
+            for (int i = 0; i < mLayout.mNumEvents; i++) {
+                p = PutDouble(p, aSample.mScales[i]);
+            }
+        }
+        for (int i = 0; i < mLayout.mNumSockets; i++) {
+            p = PutLE(p, aSample.mPackages[i].mWindow_ns, 8);
+            for (int d = 0; d < kNumDomains; d++) {
+                p = PutLE(p, aSample.mPackages[i].mTicks[d], 8);
+            }
+        }
+
+        int64_t formatted_ns = RawNow_ns();
+        mFormatTimes.Add(formatted_ns - start_ns);
+        // Only the samples that end a batch have anything to write.
+        if (++mNumBuffered == mBatch) {
+            Flush();
+            mWriteTimes.Add(RawNow_ns() - formatted_ns);
+        }
+        // Count what is buffered too, so the file doesn't overshoot the limit
+        // by up to a batch.
+        if (mSegments.IsFull(mSize + 4 + mNumBuffered * mRecordSize)) {
+            Rotate();
+        }
+    }
+
+    virtual void Rotate()
+    {
+        Flush();
+        close(mFd);
+        mSegments.Retire();
+        Open();
+    }
+};
+
+// The most clients --socket serves at once, and the longest line it sends.
+static const int kMaxSubscribers = 16;
+static const size_t kMaxLineLen = 16384;
+
+// This class serves samples on a Unix domain socket as newline-delimited
+// JSON, to any number of clients that connect to it. Each client first gets a
+// "layout" line naming the events, and then a "sample" line per sample, with
+// the counts and the machine's watts per RAPL domain.
+//
+// It runs on its own writer thread, and never waits for a client: a line that
+// doesn't fit in a client's socket buffer is kept and finished on the next
+// sample, and the next sample is dropped for that client if the last line
+// still isn't through. Clients only ever get whole lines, and can tell they
+// missed some, whether here or in a full ring on the way, from the gaps in
+// "seq", which the sampler numbers.
+class SocketOutput : public Output
+{
+    struct Subscriber
+    {
+        int mFd;
+        char mPending[kMaxLineLen]; // The unsent rest of a line.
+        size_t mPendingLen;
+        uint64_t mDropped;
+    };
+
+    const SampleLayout& mLayout;
+    const char* mPath;
+    int mListenFd;
+    Subscriber* mSubscribers[kMaxSubscribers];
+    int mNumSubscribers;
+    char mLine[kMaxLineLen];
+
+    void RemoveSubscriber(int aIndex)
+    {
+        Subscriber* subscriber = mSubscribers[aIndex];
+        close(subscriber->mFd);
+        if (subscriber->mDropped > 0) {
+            fprintf(stderr, "%s: a --socket client left after %llu samples "
+                    "were dropped for it\n", gArgv0,
+                    (unsigned long long)subscriber->mDropped);
+        }
+        delete subscriber;
+        mSubscribers[aIndex] = mSubscribers[--mNumSubscribers];
+    }
+
+    // Sends as much of the subscriber's pending line as its socket takes.
+    // Returns false if the client has gone away.
+    bool Flush(Subscriber* aSubscriber)
+    {
+        while (aSubscriber->mPendingLen > 0) {
+            ssize_t sent = send(aSubscriber->mFd, aSubscriber->mPending,
+                                aSubscriber->mPendingLen,
+                                MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (sent < 0) {
+                return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            }
+            aSubscriber->mPendingLen -= sent;
+            memmove(aSubscriber->mPending, aSubscriber->mPending + sent,
+                    aSubscriber->mPendingLen);
+        }
+        return true;
+    }
+
+    // Queues |aLine| for every subscriber that has finished the last one.
+    void Send(const char* aLine, size_t aLen)
+    {
+        for (int i = mNumSubscribers - 1; i >= 0; i--) {
+            Subscriber* subscriber = mSubscribers[i];
+            if (!Flush(subscriber)) {
+                RemoveSubscriber(i);
+                continue;
+            }
+            if (subscriber->mPendingLen > 0) {
+                subscriber->mDropped++;
+                continue;
+            }
+            memcpy(subscriber->mPending, aLine, aLen);
+            subscriber->mPendingLen = aLen;
+            if (!Flush(subscriber)) {
+                RemoveSubscriber(i);
+            }
+        }
+    }
+
+    // Takes every client waiting to connect, and sends each the layout.
+    void Accept()
+    {
+        while (true) {
+            int fd = accept4(mListenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK &&
+                    errno != ECONNABORTED && errno != EINTR) {
+                    fprintf(stderr, "%s: accept() on %s failed: %s\n", gArgv0,
+                            mPath, strerror(errno));
+                }
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                return;
+            }
+            if (mNumSubscribers == kMaxSubscribers) {
+                close(fd);
+                continue;
+            }
+            Subscriber* subscriber = new Subscriber;
+            subscriber->mFd = fd;
+            subscriber->mDropped = 0;
+            FILE* out = fmemopen(subscriber->mPending, kMaxLineLen, "w");
+            fprintf(out, "{\"type\":\"layout\",\"interval_ms\":%d,"
+                    "\"sockets\":%d,\"scales\":%s,\"events\":[",
+                    mLayout.mInterval_msec, mLayout.mNumSockets,
+                    mLayout.mHasScales ? "true" : "false");
+            for (int i = 0; i < mLayout.mNumEvents; i++) {
+                fprintf(out, "%s", i > 0 ? "," : "");
+                PrintJsonString(out, mLayout.mEventNames[i]);
+            }
+            fprintf(out, "]}\n");
+            subscriber->mPendingLen = size_t(ftell(out));
+            fclose(out);
+            mSubscribers[mNumSubscribers++] = subscriber;
+            if (!Flush(subscriber)) {
+                RemoveSubscriber(mNumSubscribers - 1);
+            }
+        }
+    }
+
+    // Prints |aString| as a JSON string, escaped, since event names come from
+    // the command line or an event file and may hold anything.
+    static void PrintJsonString(FILE* aOut, const char* aString)
+    {
+        fputc('"', aOut);
+        for (const unsigned char* c = (const unsigned char*)aString; *c; c++) {
+            if (*c == '"' || *c == '\\') {
+                fprintf(aOut, "\\%c", *c);
+            } else if (*c < 0x20) {
+                fprintf(aOut, "\\u%04x", *c);
+            } else {
+                fputc(*c, aOut);
+            }
+        }
+        fputc('"', aOut);
+    }
+
+    // Prints the watts of each domain as a JSON object, with null for the
+    // unsupported ones.
+    static void PrintWatts(FILE* aOut, const double aEnergy_J[kNumDomains],
+                           double aInterval_sec)
+    {
+        fprintf(aOut, "{");
+        for (int d = 0; d < kNumDomains; d++) {
+            fprintf(aOut, "%s\"%s\":", d > 0 ? "," : "", kDomainNames[d]);
+            if (aEnergy_J[d] == kUnsupported_j || aInterval_sec <= 0) {
+                fprintf(aOut, "null");
+            } else {
+                fprintf(aOut, "%.3f", aEnergy_J[d] / aInterval_sec);
+            }
+        }
+        fprintf(aOut, "}");
+    }
+
+public:
+    SocketOutput(const char* aPath, const SampleLayout& aLayout)
+      : mLayout(aLayout), mPath(aPath), mNumSubscribers(0)
+    {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(aPath) >= sizeof(addr.sun_path)) {
+            Abort("--socket path '%s' is too long", aPath);
+        }
+        strcpy(addr.sun_path, aPath);
+
+        mListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                           0);
+        if (mListenFd < 0) {
+            Abort("socket() failed: %s", strerror(errno));
+        }
+        // A socket left behind by an earlier run would make bind() fail, but
+        // anything else at |aPath| is most likely a typo, and not ours to
+        // delete.
+        struct stat st;
+        if (lstat(aPath, &st) == 0) {
+            if (!S_ISSOCK(st.st_mode)) {
+                Abort("%s exists and is not a socket", aPath);
+            }
+            unlink(aPath);
+        }
+        if (bind(mListenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+            listen(mListenFd, kMaxSubscribers) != 0) {
+            Abort("failed to listen on %s: %s", aPath, strerror(errno));
+        }
+    }
+
+    ~SocketOutput()
+    {
+        for (int i = mNumSubscribers - 1; i >= 0; i--) {
+            // One last try at getting the final line out.
+            Flush(mSubscribers[i]);
+            RemoveSubscriber(i);
+        }
+        close(mListenFd);
+        unlink(mPath);
+    }
+
+    virtual void Write(const Sample& aSample)
+    {
+        Accept();
+        if (mNumSubscribers == 0) {
+            return;
+        }
+
+        int64_t start_ns = RawNow_ns();
+        double energy_J[kMaxSockets][kNumDomains], window_sec[kMaxSockets];
+        double total_J[kNumDomains];
+        ComputeEnergy(mLayout, aSample, energy_J, window_sec, total_J);
+
+        FILE* out = fmemopen(mLine, sizeof(mLine), "w");
+        fprintf(out, "{\"type\":\"sample\",\"seq\":%llu,\"time_us\":%lld,"
+                "\"interval_ns\":%lld,\"events\":{",
+                (unsigned long long)aSample.mSeq,
+                (long long)aSample.mTime_usec, (long long)aSample.mInterval_ns);
+        for (int i = 0; i < mLayout.mNumEvents; i++) {
+            fprintf(out, "%s", i > 0 ? "," : "");
+            PrintJsonString(out, mLayout.mEventNames[i]);
+            fprintf(out, ":%lld", aSample.mValues[i]);
+        }
+        fprintf(out, "}");
+        if (mLayout.mHasScales) {
+            fprintf(out, ",\"scales\":{");
+            for (int i = 0; i < mLayout.mNumEvents; i++) {
+                fprintf(out, "%s", i > 0 ? "," : "");
+                PrintJsonString(out, mLayout.mEventNames[i]);
+                fprintf(out, ":%.3f", aSample.mScales[i]);
+            }
+            fprintf(out, "}");
+        }
+        if (mLayout.mNumSockets > 1) {
+            fprintf(out, ",\"sockets\":[");
+            for (int i = 0; i < mLayout.mNumSockets; i++) {
+                fprintf(out, "%s", i > 0 ? "," : "");
+                PrintWatts(out, energy_J[i], window_sec[i]);
+            }
+            fprintf(out, "]");
+        }
+        fprintf(out, ",\"watts\":");
+        PrintWatts(out, total_J, aSample.mInterval_ns / 1e9);
+        fprintf(out, "}\n");
+        long len = ftell(out);
+        fclose(out);
+        // A line that didn't fit would be cut short, which isn't JSON.
+        if (len <= 0 || size_t(len) >= sizeof(mLine) - 1) {
+            return;
+        }
+        int64_t formatted_ns = RawNow_ns();
+        Send(mLine, size_t(len));
+        mFormatTimes.Add(formatted_ns - start_ns);
+        mWriteTimes.Add(RawNow_ns() - formatted_ns);
+    }
+};
+
+// This class serves the run's cumulative energy and counts over HTTP, for
+// Prometheus or anything else that scrapes its text format. Unlike the other
+// outputs it is written to on the sampling thread, not through a
+// SampleWriter, since a sample dropped from a full ring would be lost from
+// the counters for good. The sampler adds each sample to totals of its own and
+// publishes a copy under a sequence lock, which a scrape retries its copy of
+// if it overlapped a publish, and a thread of its own answers the scrapes, so
+// the sampler never waits for a client or for a scrape.
+//
+// It only listens on the loopback interface.
+class MetricsOutput : public Output
+{
+    // Everything a scrape reports.
+    struct Totals
+    {
+        uint64_t mSamples;
+        int64_t mDuration_ns;
+        double mEnergy_J[kMaxSockets][kNumDomains];
+        double mWatts[kNumDomains];             // The last sample's.
+        long_long mCounts[kMaxEvents];
+    };
+
+    const SampleLayout& mLayout;
+    int mListenFd;
+    pthread_t mThread;
+    std::atomic<bool> mStopping;
+    Totals mTotals;                 // The sampler's own.
+    Totals mPublished;              // Its copy for scrapes, under |mSeq|.
+    std::atomic<uint32_t> mSeq;     // Odd while |mPublished| is being written.
+
+    static void* ThreadMain(void* aArg)
+    {
+        static_cast<MetricsOutput*>(aArg)->Run();
+        return NULL;
+    }
+
+    void Run()
+    {
+        while (!mStopping.load()) {
+            // Wake up now and then to notice Stop().
+            struct pollfd pfd;
+            pfd.fd = mListenFd;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, 200) <= 0) {
+                continue;
+            }
+            int fd = accept4(mListenFd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd < 0) {
+                continue;
+            }
+            // A client that stalls holds up only the next scrape.
+            struct timeval timeout = { 1, 0 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            Serve(fd);
+            close(fd);
+        }
+    }
+
+    void Serve(int aFd)
+    {
+        // The request line and headers; the body of a GET is empty.
+        char request[4096];
+        size_t len = 0;
+        while (len < sizeof(request) - 1) {
+            ssize_t n = recv(aFd, request + len, sizeof(request) - 1 - len, 0);
+            if (n <= 0) {
+                return;
+            }
+            len += n;
+            request[len] = '\0';
+            if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+                break;
+            }
+        }
+        request[len] = '\0';
+
+        char* body = NULL;
+        size_t bodyLen = 0;
+        const char* status = "200 OK";
+        if (strncmp(request, "GET /metrics ", 13) == 0 ||
+            strncmp(request, "GET / ", 6) == 0) {
+            FILE* out = open_memstream(&body, &bodyLen);
+            WriteMetrics(out);
+            fclose(out);
+        } else {
+            status = strncmp(request, "GET ", 4) == 0 ? "404 Not Found"
+                                                     : "405 Method Not Allowed";
+        }
+
+        char header[256];
+        int headerLen = snprintf(header, sizeof(header),
+                                 "HTTP/1.0 %s\r\n"
+                                 "Content-Type: text/plain; version=0.0.4\r\n"
+                                 "Content-Length: %zu\r\n"
+                                 "Connection: close\r\n\r\n", status, bodyLen);
+        if (send(aFd, header, headerLen, MSG_NOSIGNAL) == headerLen &&
+            bodyLen > 0) {
+            send(aFd, body, bodyLen, MSG_NOSIGNAL);
+        }
+        free(body);
+    }
+
+    void WriteMetrics(FILE* aOut)
+    {
+        Totals totals;
+        for (;;) {
+            uint32_t seq = mSeq.load(std::memory_order_acquire);
+            if (seq & 1) {
+                sched_yield();
+                continue;
+            }
+            memcpy(&totals, &mPublished, sizeof(totals));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (mSeq.load(std::memory_order_relaxed) == seq) {
+                break;
+            }
+        }
+
+        fprintf(aOut,
+                "# HELP rp_t2_samples_total Samples taken.\n"
+                "# TYPE rp_t2_samples_total counter\n"
+                "rp_t2_samples_total %llu\n"
+                "# HELP rp_t2_sampled_seconds_total Time covered by the "
+                "samples.\n"
+                "# TYPE rp_t2_sampled_seconds_total counter\n"
+                "rp_t2_sampled_seconds_total %.6f\n",
+                (unsigned long long)totals.mSamples,
+                totals.mDuration_ns / 1e9);
+
+        fprintf(aOut,
+                "# HELP rp_t2_energy_joules_total Energy used, by socket and "
+                "RAPL domain.\n"
+                "# TYPE rp_t2_energy_joules_total counter\n");
+        for (int i = 0; i < mLayout.mNumSockets; i++) {
+            for (int d = 0; d < kNumDomains; d++) {
+                if (mLayout.mJoulesPerTick[i][d] != 0) {
+                    fprintf(aOut, "rp_t2_energy_joules_total{socket=\"%d\","
+                            "domain=\"%s\"} %.6f\n", i, kDomainNames[d],
+                            totals.mEnergy_J[i][d]);
+                }
+            }
+        }
+
+        fprintf(aOut,
+                "# HELP rp_t2_power_watts The machine's power over the last "
+                "sample, by RAPL domain.\n"
+                "# TYPE rp_t2_power_watts gauge\n");
+        for (int d = 0; d < kNumDomains; d++) {
+            if (totals.mWatts[d] != kUnsupported_j) {
+                fprintf(aOut, "rp_t2_power_watts{domain=\"%s\"} %.3f\n",
+                        kDomainNames[d], totals.mWatts[d]);
+            }
+        }
+
+        fprintf(aOut,
+                "# HELP rp_t2_events_total PAPI event counts.\n"
+                "# TYPE rp_t2_events_total counter\n");
+        for (int i = 0; i < mLayout.mNumEvents; i++) {
+            fprintf(aOut, "rp_t2_events_total{event=\"%s\"} %lld\n",
+                    mLayout.mEventNames[i], totals.mCounts[i]);
+        }
+    }
+
+public:
+    MetricsOutput(int aPort, const SampleLayout& aLayout)
+      : mLayout(aLayout), mStopping(false), mSeq(0)
+    {
+        memset(&mTotals, 0, sizeof(mTotals));
+        for (int d = 0; d < kNumDomains; d++) {
+            mTotals.mWatts[d] = kUnsupported_j;
+        }
+        mPublished = mTotals;
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(uint16_t(aPort));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        mListenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (mListenFd < 0) {
+            Abort("socket() failed: %s", strerror(errno));
+        }
+        int one = 1;
+        setsockopt(mListenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(mListenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+            listen(mListenFd, 16) != 0) {
+            Abort("failed to listen on port %d: %s", aPort, strerror(errno));
+        }
+
+        StartThread(&mThread, ThreadMain, this);
+    }
+
+    ~MetricsOutput()
+    {
+        mStopping.store(true);
+        pthread_join(mThread, NULL);
+        close(mListenFd);
+    }
+
+    virtual void Write(const Sample& aSample)
+    {
+        double energy_J[kMaxSockets][kNumDomains], window_sec[kMaxSockets];
+        double total_J[kNumDomains];
+        ComputeEnergy(mLayout, aSample, energy_J, window_sec, total_J);
+        double interval_sec = aSample.mInterval_ns / 1e9;
+
+        mTotals.mSamples++;
+        mTotals.mDuration_ns += aSample.mInterval_ns;
+        for (int i = 0; i < mLayout.mNumSockets; i++) {
+            for (int d = 0; d < kNumDomains; d++) {
+                if (energy_J[i][d] != kUnsupported_j) {
+                    mTotals.mEnergy_J[i][d] += energy_J[i][d];
+                }
+            }
+        }
+        for (int d = 0; d < kNumDomains; d++) {
+            mTotals.mWatts[d] = total_J[d] == kUnsupported_j || interval_sec <= 0
+                              ? kUnsupported_j : total_J[d] / interval_sec;
+        }
+        for (int i = 0; i < mLayout.mNumEvents; i++) {
+            mTotals.mCounts[i] += aSample.mValues[i];
+        }
+
+        uint32_t seq = mSeq.load(std::memory_order_relaxed);
+        mSeq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(&mPublished, &mTotals, sizeof(mPublished));
+        mSeq.store(seq + 2, std::memory_order_release);
+    }
+};
+
+// This class moves samples off the sampling thread: the sampler pushes them
+// into a lock-free single-producer single-consumer ring, and a writer thread
+// pops, formats and writes them, so a slow disk never delays the next sample.
+// When the ring is full the new sample is dropped and counted.
+class SampleWriter
+{
+    Output* mOutput;
+    Sample* mSlots;
+    size_t mMask;                       // The capacity, a power of two, less 1.
+    std::atomic<size_t> mHead;          // The next slot to push; the sampler's.
+    std::atomic<size_t> mTail;          // The next slot to pop; the writer's.
+    std::atomic<uint64_t> mDropped;
+    std::atomic<bool> mStopping;
+    std::atomic<bool> mRotating;
+    sem_t mPushed;                      // Posted once per push, on Rotate()
+                                        // and on Stop().
+    pthread_t mThread;
+
+    static void* ThreadMain(void* aArg)
+    {
+        static_cast<SampleWriter*>(aArg)->Run();
+        return NULL;
+    }
+
+    void Run()
+    {
+        uint64_t reportedDropped = 0;
+        while (true) {
+            while (sem_wait(&mPushed) != 0 && errno == EINTR) {
+            }
+
+            if (mRotating.exchange(false)) {
+                mOutput->Rotate();
+            }
+
+            size_t tail = mTail.load(std::memory_order_relaxed);
+            if (tail == mHead.load(std::memory_order_acquire)) {
+                if (mStopping.load()) {
+                    break;
+                }
+                continue;
+            }
+            mOutput->Write(mSlots[tail & mMask]);
+            mTail.store(tail + 1, std::memory_order_release);
+
+            uint64_t dropped = mDropped.load(std::memory_order_relaxed);
+            if (dropped != reportedDropped) {
+                fprintf(stderr, "%s: writer fell behind, %llu samples dropped "
+                        "so far\n", gArgv0, (unsigned long long)dropped);
+                reportedDropped = dropped;
+            }
+        }
+    }
+
+public:
+    // |aCapacity| is rounded up to a power of two.
+    SampleWriter(Output* aOutput, size_t aCapacity)
+      : mOutput(aOutput), mHead(0), mTail(0), mDropped(0), mStopping(false),
+        mRotating(false)
+    {
+        size_t capacity = 1;
+        while (capacity < aCapacity) {
+            capacity *= 2;
+        }
+        mMask = capacity - 1;
+        mSlots = new Sample[capacity];
+
+        if (sem_init(&mPushed, 0, 0) != 0) {
+            Abort("sem_init() failed: %s", strerror(errno));
+        }
+        StartThread(&mThread, ThreadMain, this);
+    }
+
+    // Writes out everything still in the ring and joins the writer thread.
+    ~SampleWriter()
+    {
+        mStopping.store(true);
+        sem_post(&mPushed);
+        pthread_join(mThread, NULL);
+        sem_destroy(&mPushed);
+        delete[] mSlots;
+
+        uint64_t dropped = mDropped.load();
+        if (dropped > 0) {
+            fprintf(stderr, "%s: %llu samples dropped because the writer fell "
+                    "behind\n", gArgv0, (unsigned long long)dropped);
+        }
+    }
+
+    // Called only from the sampling thread. Never blocks.
+    void Push(const Sample& aSample)
+    {
+        size_t head = mHead.load(std::memory_order_relaxed);
+        if (head - mTail.load(std::memory_order_acquire) > mMask) {
+            mDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        mSlots[head & mMask] = aSample;
+        mHead.store(head + 1, std::memory_order_release);
+        sem_post(&mPushed);
+    }
+
+    // Has the writer thread rotate the output before it writes anything
+    // else. Never blocks.
+    void Rotate()
+    {
+        mRotating.store(true);
+        sem_post(&mPushed);
+    }
+};
+
+// Converts a binary output file to the CSV that would have been written
+// directly. Returns the process exit status.
+static int
+DumpBinary(const char* aFilename, FILE* aOut)
+{
+    FILE* in = fopen(aFilename, "rb");
+    if (!in) {
+        Abort("failed to open %s: %s", aFilename, strerror(errno));
+    }
+
+    static SampleLayout layout;
+    static Sample sample;
+    uint8_t magic[sizeof(kBinaryMagic)];
+    size_t recordSize = 0;
+    uint8_t* record = NULL;
+    uint32_t version = 0;           // The current segment's; 0 before any.
+    uint32_t batchLeft = 0;         // Records left in the current batch.
+    int status = 0;
+
+    while (true) {
+        // Only where a batch, or a record before version 3, could start can a
+        // header start, with the magic.
+        const uint8_t* prefix = magic;
+        size_t n = 0;
+        if (version < 3 || batchLeft == 0) {
+            n = fread(magic, 1, sizeof(magic), in);
+            if (n == 0) {
+                break;
+            }
+        }
+        if (n == sizeof(magic) &&
+            memcmp(magic, kBinaryMagic, sizeof(magic)) == 0) {
+            uint8_t fixed[5 * 4];
+            if (fread(fixed, 1, 4 * 4, in) != 4 * 4) {
+                Abort("%s: truncated header", aFilename);
+            }
+            version = uint32_t(GetLE(fixed, 4));
+            batchLeft = 0;
+            if (version < 1 || version > kBinaryVersion) {
+                Abort("%s: unsupported version %u", aFilename, version);
+            }
+            layout.mInterval_msec = int(GetLE(fixed + 4, 4));
+            layout.mNumEvents     = int(GetLE(fixed + 8, 4));
+            layout.mNumSockets    = int(GetLE(fixed + 12, 4));
+            uint32_t flags = 0;
+            if (version >= 2) {
+                if (fread(fixed + 16, 1, 4, in) != 4) {
+                    Abort("%s: truncated header", aFilename);
+                }
+                flags = uint32_t(GetLE(fixed + 16, 4));
+            }
+            layout.mHasScales = (flags & kBinaryHasScales) != 0;
+            if (layout.mNumEvents < 0 || layout.mNumEvents > kMaxEvents ||
+                layout.mNumSockets < 1 || layout.mNumSockets > kMaxSockets) {
+                Abort("%s: corrupt header", aFilename);
+            }
+            for (int i = 0; i < layout.mNumEvents; i++) {
+                if (fread(layout.mEventNames[i], 1, kMaxEventNameLen, in) !=
+                    size_t(kMaxEventNameLen)) {
+                    Abort("%s: truncated header", aFilename);
+                }
+                layout.mEventNames[i][kMaxEventNameLen - 1] = '\0';
+            }
+            for (int i = 0; i < layout.mNumSockets; i++) {
+                for (int d = 0; d < kNumDomains; d++) {
+                    uint8_t buf[8];
+                    if (fread(buf, 1, sizeof(buf), in) != sizeof(buf)) {
+                        Abort("%s: truncated header", aFilename);
+                    }
+                    layout.mJoulesPerTick[i][d] = GetDouble(buf);
+                }
+            }
+
+            recordSize = BinaryRecordSize(layout);
+            record = (uint8_t*)realloc(record, recordSize);
+            if (!record) {
+                Abort("realloc() failed");
+            }
+            WriteCsvHeader(aOut, layout);
+            continue;
+        }
+
+        if (version == 0) {
+            Abort("%s: not an rp_t2 binary file", aFilename);
+        }
+        // What was read past a batch's count is the start of its first record.
+        if (version >= 3 && batchLeft == 0) {
+            if (n < 4) {
+                fprintf(stderr, "%s: %s: ignoring truncated last batch\n",
+                        gArgv0, aFilename);
+                status = 1;
+                break;
+            }
+            batchLeft = uint32_t(GetLE(magic, 4));
+            if (batchLeft == 0 || batchLeft > uint32_t(kMaxBatch)) {
+                Abort("%s: corrupt batch", aFilename);
+            }
+            prefix = magic + 4;
+            n -= 4;
+        }
+        memcpy(record, prefix, n);
+        n += fread(record + n, 1, recordSize - n, in);
+        if (n != recordSize) {
+            fprintf(stderr, "%s: %s: ignoring truncated last record\n",
+                    gArgv0, aFilename);
+            status = 1;
+            break;
+        }
+        if (batchLeft > 0) {
+            batchLeft--;
+        }
+
+        const uint8_t* p = record;
+        sample.mTime_usec   = int64_t(GetLE(p, 8)); p += 8;
+        sample.mInterval_ns = int64_t(GetLE(p, 8)); p += 8;
+        for (int i = 0; i < layout.mNumEvents; i++) {
+            sample.mValues[i] = long_long(GetLE(p, 8)); p += 8;
+        }
+        if (layout.mHasScales) {
+            for (int i = 0; i < layout.mNumEvents; i++) {
+                sample.mScales[i] = GetDouble(p); p += 8;
+            }
+        }
+        for (int i = 0; i < layout.mNumSockets; i++) {
+            sample.mPackages[i].mWindow_ns = GetLE(p, 8); p += 8;
+            for (int d = 0; d < kNumDomains; d++) {
+                sample.mPackages[i].mTicks[d] = GetLE(p, 8); p += 8;
+            }
+        }
+        WriteCsvRow(aOut, layout, sample);
+    }
+
+    free(record);
+    fclose(in);
+    return status;
+}
+
+// Appends the event names in |aFilename| to |aNames|. They are separated as
+// for --events, and '#' starts a comment that runs to the end of the line.
+static void
+ReadEventFile(const char* aFilename, const char** aNames, int& aNumNames)
+{
+    FILE* in = fopen(aFilename, "r");
+    if (!in) {
+        Abort("failed to open %s: %s", aFilename, strerror(errno));
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), in)) {
+        char* comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        SplitEventNames(strdup(line), aNames, aNumNames);
+    }
+    fclose(in);
+}
+
+//---------------------------------------------------------------------------
+// Workload
+//---------------------------------------------------------------------------
+
+// The workload's pid, once it is forked.
+static volatile pid_t gWorkloadPid = 0;
+
+static void
+OnSigchld(int)
+{
+    // The gzips of rotated files are children too, and children that exit
+    // together can raise one SIGCHLD, so ask whether the workload exited,
+    // leaving it to be waited for.
+    int savedErrno = errno;
+    siginfo_t info;
+    info.si_pid = 0;
+    if (gWorkloadPid > 0 &&
+        waitid(P_PID, gWorkloadPid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 &&
+        info.si_pid != 0) {
+        gStop = 1;
+    }
+    errno = savedErrno;
+}
+
+// Forks the workload |aArgv|. The child blocks until StartWorkload() is
+// called, so that the counters can be attached to it before it runs any of its
+// own code. Returns its pid, and in |aGoFd| the fd that releases it.
+static pid_t
+ForkWorkload(char** aArgv, int* aGoFd)
+{
+    // SIGCHLD cuts the current sample period short when the workload exits.
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = OnSigchld;
+    action.sa_flags = SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &action, NULL);
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        Abort("pipe() failed: %s", strerror(errno));
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        Abort("fork() failed: %s", strerror(errno));
+    }
+    if (pid == 0) {
+        close(fds[1]);
+        // EOF means the monitor failed to start, so don't run the workload.
+        char go;
+        if (read(fds[0], &go, 1) != 1) {
+            _exit(127);
+        }
+        close(fds[0]);
+        execvp(aArgv[0], aArgv);
+        fprintf(stderr, "%s: failed to run %s: %s\n", gArgv0, aArgv[0],
+                strerror(errno));
+        _exit(127);
+    }
+    close(fds[0]);
+    *aGoFd = fds[1];
+    gWorkloadPid = pid;
+    return pid;
+}
+
+static void
+StartWorkload(int aGoFd)
+{
+    char go = 1;
+    if (write(aGoFd, &go, 1) != 1) {
+        Abort("failed to start the workload: %s", strerror(errno));
+    }
+    close(aGoFd);
+}
+
+// Moves |aPid| into the cgroup v2 directory |aCgroup|. Its descendants
+// inherit the cgroup.
+static void
+MoveToCgroup(pid_t aPid, const char* aCgroup)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/cgroup.procs", aCgroup);
+    FILE* procs = fopen(path, "w");
+    if (!procs) {
+        Abort("failed to open %s: %s", path, strerror(errno));
+    }
+    fprintf(procs, "%d\n", int(aPid));
+    if (fclose(procs) != 0) {
+        Abort("failed to move %d into %s: %s", int(aPid), aCgroup,
+              strerror(errno));
+    }
+}
+
+// Returns the CPU time used by everything in |aCgroup|, from the usage_usec
+// line of its cpu.stat, or -1 if that isn't available.
+static int64_t
+CgroupUsage_usec(const char* aCgroup)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/cpu.stat", aCgroup);
+    FILE* stat = fopen(path, "r");
+    if (!stat) {
+        return -1;
+    }
+    long long usage = -1;
+    char line[256];
+    while (fgets(line, sizeof(line), stat)) {
+        if (sscanf(line, "usage_usec %lld", &usage) == 1) {
+            break;
+        }
+    }
+    fclose(stat);
+    return usage;
+}
+
+static const int kMaxThreads = 256;
+
+// The most scans that go by between refreshes of a thread's name. Names
+// rarely change once a thread is going, so reading them for every sample
+// isn't worth its cost, but a new thread is often renamed or exec()s soon
+// after it starts, so a thread's name is re-read after 1 scan, then 2, 4 and
+// so on up to this.
+static const int kCommRefreshScans = 32;
+
+static int
+CompareTids(const void* aA, const void* aB)
+{
+    pid_t a = *(const pid_t*)aA, b = *(const pid_t*)aB;
+    return a < b ? -1 : a > b;
+}
+
+// This class counts the events separately for each thread of a process, for
+// --per-thread. Every thread listed in /proc/PID/task gets an event set of its
+// own, so that the machine's power can be split between the threads in
+// proportion to the cycles each one used.
+//
+// Threads are found when Scan() runs, so a thread's counts start at the first
+// sample after it was created, and whatever it counted after the last sample
+// before it exited is lost.
+class ThreadCounters
+{
+    struct Thread
+    {
+        pid_t mTid;
+        char mComm[16];
+        int mCommInterval;          // The scans between reads of |mComm|.
+        int mCommDue;               // The scans until the next one.
+        Counters* mCounters;
+        bool mLive;                 // Was it found by the last Scan()?
+        long_long mValues[kMaxEvents];
+    };
+
+    pid_t mPid;
+    const Counters* mEvents;        // The events to count in each thread.
+    int mCyclesCode;
+    int mCycles;                    // The index of |mCyclesCode| in each set.
+    Thread mThreads[kMaxThreads];
+    int mNumThreads;
+    bool mWarnedFull;
+
+    void ReadComm(Thread& aThread)
+    {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "/proc/%d/task/%d/comm", int(mPid),
+                 int(aThread.mTid));
+        aThread.mComm[0] = '\0';
+        FILE* comm = fopen(path, "r");
+        if (comm) {
+            if (fgets(aThread.mComm, sizeof(aThread.mComm), comm)) {
+                aThread.mComm[strcspn(aThread.mComm, "\n")] = '\0';
+            }
+            fclose(comm);
+        }
+        // The comm goes into a CSV column unquoted.
+        for (char* c = aThread.mComm; *c; c++) {
+            if (*c == ',' || !isprint((unsigned char)*c)) {
+                *c = '_';
+            }
+        }
+    }
+
+    // Starts counting |aTid|. Returns false if it couldn't be attached,
+    // which happens when it has already exited.
+    bool AddThread(pid_t aTid)
+    {
+        Thread& thread = mThreads[mNumThreads];
+        thread.mTid = aTid;
+        thread.mLive = true;
+        thread.mCounters = new Counters(/* aMultiplex = */ false,
+                                        /* aInherit = */ false);
+        for (int i = 0; i < mEvents->NumEvents(); i++) {
+            if (thread.mCounters->Add(mEvents->Code(i), mEvents->Name(i)) !=
+                PAPI_OK) {
+                Abort("failed to add %s to the counters of thread %d",
+                      mEvents->Name(i), int(aTid));
+            }
+        }
+        if (mCycles == mEvents->NumEvents() &&
+            thread.mCounters->Add(mCyclesCode, "cycles") != PAPI_OK) {
+            Abort("failed to add cycles to the counters of thread %d",
+                  int(aTid));
+        }
+        if (thread.mCounters->Attach(aTid) != PAPI_OK ||
+            !thread.mCounters->Start()) {
+            delete thread.mCounters;
+            return false;
+        }
+        ReadComm(thread);
+        thread.mCommInterval = thread.mCommDue = 1;
+        mNumThreads++;
+        return true;
+    }
+
+    void RemoveThread(int aIndex)
+    {
+        mThreads[aIndex].mCounters->Stop();
+        delete mThreads[aIndex].mCounters;
+        mThreads[aIndex] = mThreads[--mNumThreads];
+    }
+
+public:
+    // Counts |aEvents|' events in each thread of |aPid|, plus a cycles event
+    // if there isn't one among them.
+    ThreadCounters(pid_t aPid, const Counters* aEvents)
+      : mPid(aPid), mEvents(aEvents), mNumThreads(0), mWarnedFull(false)
+    {
+        const char* kCycleEvents[] = { "PAPI_TOT_CYC", "PAPI_REF_CYC" };
+        mCyclesCode = PAPI_NULL;
+        for (size_t i = 0; i < sizeof(kCycleEvents) / sizeof(*kCycleEvents); i++) {
+            int code;
+            if (PAPI_event_name_to_code((char*)kCycleEvents[i], &code) == PAPI_OK &&
+                PAPI_query_event(code) == PAPI_OK) {
+                mCyclesCode = code;
+                break;
+            }
+        }
+        if (mCyclesCode == PAPI_NULL) {
+            Abort("--per-thread needs PAPI_TOT_CYC or PAPI_REF_CYC");
+        }
+        mCycles = mEvents->NumEvents();
+        for (int i = 0; i < mEvents->NumEvents(); i++) {
+            if (mEvents->Code(i) == mCyclesCode) {
+                mCycles = i;
+            }
+        }
+    }
+
+    ~ThreadCounters()
+    {
+        while (mNumThreads > 0) {
+            RemoveThread(mNumThreads - 1);
+        }
+    }
+
+    // Starts counting the threads created since the last scan, and updates
+    // the names of the others that are due, which change on exec() and
+    // prctl().
+    void Scan()
+    {
+        for (int i = 0; i < mNumThreads; i++) {
+            Thread& thread = mThreads[i];
+            if (--thread.mCommDue == 0) {
+                ReadComm(thread);
+                if (thread.mCommInterval < kCommRefreshScans) {
+                    thread.mCommInterval *= 2;
+                }
+                thread.mCommDue = thread.mCommInterval;
+            }
+        }
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "/proc/%d/task", int(mPid));
+        DIR* dir = opendir(path);
+        if (!dir) {
+            return;                 // The process has exited.
+        }
+        // The known threads, sorted so each entry is looked up in log time.
+        pid_t known[kMaxThreads];
+        int numKnown = mNumThreads;
+        for (int i = 0; i < numKnown; i++) {
+            known[i] = mThreads[i].mTid;
+        }
+        qsort(known, numKnown, sizeof(known[0]), CompareTids);
+
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (!isdigit((unsigned char)entry->d_name[0])) {
+                continue;
+            }
+            pid_t tid = atoi(entry->d_name);
+            if (bsearch(&tid, known, numKnown, sizeof(known[0]), CompareTids)) {
+                continue;
+            }
+            if (mNumThreads == kMaxThreads) {
+                if (!mWarnedFull) {
+                    fprintf(stderr, "%s: only the first %d threads of %d are "
+                            "counted\n", gArgv0, kMaxThreads, int(mPid));
+                    mWarnedFull = true;
+                }
+                break;
+            }
+            AddThread(tid);
+        }
+        closedir(dir);
+    }
+
+    // Reads every thread's counts for the period of |aSample|, which has the
+    // machine-wide counts for it, and with |aPush| queues a row for each
+    // thread on |aWriter|. Threads that have exited are dropped.
+    void Read(const Sample& aSample, bool aPush, SampleWriter* aWriter)
+    {
+        static Sample row;
+        double unused[kMaxEvents];
+        long_long totalCycles = 0;
+        for (int i = 0; i < mNumThreads; i++) {
+            Thread& thread = mThreads[i];
+            thread.mLive = thread.mCounters->Read(aSample.mInterval_ns,
+                                                  thread.mValues, unused);
+            if (thread.mLive) {
+                totalCycles += thread.mValues[mCycles];
+            }
+        }
+
+        for (int i = 0; i < mNumThreads; i++) {
+            const Thread& thread = mThreads[i];
+            if (!thread.mLive || !aPush) {
+                continue;
+            }
+            row = aSample;
+            row.mTid = thread.mTid;
+            memcpy(row.mComm, thread.mComm, sizeof(row.mComm));
+            memcpy(row.mValues, thread.mValues,
+                   mEvents->NumEvents() * sizeof(row.mValues[0]));
+            row.mCycleShare = totalCycles > 0
+                            ? double(thread.mValues[mCycles]) / totalCycles : 0;
+            aWriter->Push(row);
+        }
+
+        for (int i = mNumThreads - 1; i >= 0; i--) {
+            if (!mThreads[i].mLive) {
+                RemoveThread(i);
+            }
+        }
+    }
+};
+
+// The energy and counter totals over a whole run.
+struct RunTotals
+{
+    int64_t mDuration_ns;
+    double mEnergy_J[kNumDomains];  // Machine totals, kUnsupported_j if none.
+    long_long mCounts[kMaxEvents];
+
+    RunTotals()
+      : mDuration_ns(0)
+    {
+        for (int d = 0; d < kNumDomains; d++) {
+            mEnergy_J[d] = kUnsupported_j;
+        }
+        memset(mCounts, 0, sizeof(mCounts));
+    }
+
+    void Add(const SampleLayout& aLayout, const Sample& aSample)
+    {
+        mDuration_ns += aSample.mInterval_ns;
+        for (int i = 0; i < aLayout.mNumSockets; i++) {
+            for (int d = 0; d < kNumDomains; d++) {
+                double joulesPerTick = aLayout.mJoulesPerTick[i][d];
+                if (joulesPerTick != 0) {
+                    AccumulateEstimate(mEnergy_J[d],
+                                       aSample.mPackages[i].mTicks[d] *
+                                       joulesPerTick);
+                }
+            }
+        }
+        for (int i = 0; i < aLayout.mNumEvents; i++) {
+            mCounts[i] += aSample.mValues[i];
+        }
+    }
+
+    void Print(FILE* aOut, const SampleLayout& aLayout) const
+    {
+        double duration_sec = mDuration_ns / 1e9;
+        fprintf(aOut, "total: %.3f s\n", duration_sec);
+        for (int d = 0; d < kNumDomains; d++) {
+            if (mEnergy_J[d] != kUnsupported_j) {
+                fprintf(aOut, "total: %-6s %12.3f J  %8.2f W average\n",
+                        kDomainNames[d], mEnergy_J[d],
+                        duration_sec > 0 ? mEnergy_J[d] / duration_sec : 0);
+            }
+        }
+        for (int i = 0; i < aLayout.mNumEvents; i++) {
+            fprintf(aOut, "total: %s %lld\n", aLayout.mEventNames[i],
+                    mCounts[i]);
+        }
+    }
+};
+
+static void
+OnStopSignal(int aSignal, siginfo_t* aInfo, void*)
+{
+    gStop = 1;
+    // Pass the signal on to the workload, which we would otherwise wait for,
+    // unless it is a Ctrl-C or the like that the terminal has already sent to
+    // the whole foreground process group.
+    if (gWorkloadPid > 0 && aInfo->si_code != SI_KERNEL) {
+        int savedErrno = errno;
+        kill(gWorkloadPid, aSignal);
+        errno = savedErrno;
+    }
+}
+
+static void
+OnSighup(int)
+{
+    gRotate = 1;
+}
+
+// SIGINT and SIGTERM end the run as if the last sample had been taken, so
+// that the output is flushed and the counters are torn down, and SIGHUP
+// rotates the output files.
+static void
+InstallSignalHandlers()
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_flags = SA_RESTART | SA_SIGINFO;
+    action.sa_sigaction = OnStopSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    action.sa_flags = SA_RESTART;
+    action.sa_handler = OnSighup;
+    sigaction(SIGHUP, &action, NULL);
+}
+
+// Writes out dirty pages and then frees the page cache and the reclaimable
+// slab objects (dentries and inodes), so that the run starts cold. Needs root.
+static void
+DropCaches()
+{
+    int64_t start_ns = MonotonicNow_ns();
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    if (fd < 0 || write(fd, "3\n", 2) != 2) {
+        Abort("failed to drop the caches: %s", strerror(errno));
+    }
+    close(fd);
+    fprintf(stderr, "dropped the caches in %.1f ms\n",
+            (MonotonicNow_ns() - start_ns) / 1e6);
+}
+
+static void
+Usage()
+{
+    fprintf(stderr,
+            "usage: %s [options] [-- command [args...]]\n"
+            "\n"
+            "With a command, run it and count only it and its descendants,\n"
+            "until it exits, then print the whole-run totals.\n"
+            "\n"
+            "SIGINT and SIGTERM end the run cleanly. SIGHUP rotates the output\n"
+            "files: each is renamed NAME.YYYYMMDD-HHMMSS and a new one started.\n"
+            "\n"
+            "  --events=LIST     count the comma-separated PAPI preset or native\n"
+            "                    events in LIST (default: %s)\n"
+            "  --event-file=FILE count the events listed in FILE, separated by\n"
+            "                    commas or white space, with # comments\n"
+            "  --interval=MSEC   the sample interval (default: %d)\n"
+            "  --count=N         stop after N samples (default: %d)\n"
+            "  --daemon          run until SIGINT or SIGTERM instead of stopping\n"
+            "                    after --count samples\n"
+            "  --output=FILE     write to FILE (default: util-power-HH-MM.csv,\n"
+            "                    or .bin in binary format)\n"
+            "  --rotate-size=N   also rotate the output files when they reach N\n"
+            "                    bytes, with an optional K, M or G suffix\n"
+            "  --rotate-time=SEC also rotate the output files every SEC seconds\n"
+            "  --compress        gzip the output files in the background once\n"
+            "                    they are rotated\n"
+            "  --pid=PID         count events for process PID instead of this\n"
+            "                    one\n"
+            "  --cgroup=DIR      run the command in the cgroup v2 directory DIR\n"
+            "  --sysfs-root=DIR  read the power PMU and CPU topology from DIR\n"
+            "                    instead of /sys\n"
+            "  --rapl-backend=auto|perf|msr\n"
+            "                    how to read RAPL: the perf power PMU, the MSRs\n"
+            "                    via /dev/cpu/N/msr, or perf if available\n"
+            "                    (default: auto)\n"
+            "  --msr-path=FORMAT read MSRs from FORMAT, where %%d is the CPU\n"
+            "                    (default: /dev/cpu/%%d/msr)\n"
+            "  --event-cache=DIR|none\n"
+            "                    remember which events each CPU model lacks in\n"
+            "                    DIR, so later runs skip them quickly (default:\n"
+            "                    $XDG_CACHE_HOME/rp_t2 or ~/.cache/rp_t2)\n"
+            "  --drop-caches     drop the page cache, dentries and inodes before\n"
+            "                    starting, so the run starts cold (needs root)\n"
+            "  --multiplex       count events that cannot be scheduled together\n"
+            "                    by rotating event sets across sample periods,\n"
+            "                    with a scale column for each; with no events\n"
+            "                    given, count every available preset event\n"
+            "  --per-thread      also count each thread of the process\n"
+            "                    separately, and write them with each thread's\n"
+            "                    share of the power to OUTPUT.threads.csv\n"
+            "  --format=csv|binary\n"
+            "                    the output file format (default: csv)\n"
+            "  --batch=N         buffer N samples per write() in binary format\n"
+            "                    (default: 64)\n"
+            "  --ring-size=N     queue up to N samples for the writer thread\n"
+            "                    before dropping them (default: 256)\n"
+            "  --socket=PATH     also serve the samples to any clients of the\n"
+            "                    Unix domain socket PATH, as JSON lines\n"
+            "  --metrics-port=PORT\n"
+            "                    serve the cumulative energy and event counts\n"
+            "                    in the Prometheus text format on\n"
+            "                    http://localhost:PORT/metrics\n"
+            "  --overhead        add a column with the microseconds the sampler\n"
+            "                    spent taking each sample, in csv format\n"
+            "  --dump=FILE       convert the binary FILE to CSV on stdout\n"
+            "  --help            print this message\n",
+            gArgv0, kDefaultEvents, sampleInterval_msec, sampleCount);
+}
+
+int
+main(int argc, char** argv)
+{
+    gArgv0 = argv[0];
+    int64_t start_ns = MonotonicNow_ns();
+
+    static const struct option longOptions[] = {
+        { "events",       required_argument, NULL, 'e' },
+        { "event-file",   required_argument, NULL, 'E' },
+        { "interval",     required_argument, NULL, 'i' },
+        { "count",        required_argument, NULL, 'c' },
+        { "daemon",       no_argument,       NULL, 'D' },
+        { "output",       required_argument, NULL, 'o' },
+        { "rotate-size",  required_argument, NULL, 'z' },
+        { "rotate-time",  required_argument, NULL, 'T' },
+        { "compress",     no_argument,       NULL, 'Z' },
+        { "pid",          required_argument, NULL, 'p' },
+        { "cgroup",       required_argument, NULL, 'g' },
+        { "sysfs-root",   required_argument, NULL, 'r' },
+        { "rapl-backend", required_argument, NULL, 'b' },
+        { "msr-path",     required_argument, NULL, 'm' },
+        { "event-cache",  required_argument, NULL, 'C' },
+        { "drop-caches",  no_argument,       NULL, 'K' },
+        { "multiplex",    no_argument,       NULL, 'x' },
+        { "per-thread",   no_argument,       NULL, 't' },
+        { "format",       required_argument, NULL, 'f' },
+        { "batch",        required_argument, NULL, 'B' },
+        { "ring-size",    required_argument, NULL, 'R' },
+        { "socket",       required_argument, NULL, 'S' },
+        { "metrics-port", required_argument, NULL, 'M' },
+        { "overhead",     no_argument,       NULL, 'O' },
+        { "dump",         required_argument, NULL, 'd' },
+        { "help",         no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    const char* eventNames[kMaxEvents];
+    int numEventNames = 0;
+    bool daemon = false;
+    const char* outputFile = NULL;
+    pid_t pid = 0;
+    const char* cgroup = NULL;
+    RAPL::Backend backend = RAPL::Auto;
+    const char* eventCache = NULL;
+    bool dropCaches = false;
+    bool multiplex = false;
+    bool perThread = false;
+    bool binary = false;
+    int batch = 64;
+    int ringSize = 256;
+    const char* socketPath = NULL;
+    int metricsPort = 0;
+    bool overheadColumn = false;
+    const char* dumpFile = NULL;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+h", longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'e':
+            SplitEventNames(optarg, eventNames, numEventNames);
+            break;
+        case 'E':
+            ReadEventFile(optarg, eventNames, numEventNames);
+            break;
+        case 'i':
+            sampleInterval_msec = atoi(optarg);
+            if (sampleInterval_msec < 1) {
+                Abort("--interval must be at least 1 ms");
+            }
+            break;
+        case 'c':
+            sampleCount = atoi(optarg);
+            if (sampleCount < 1) {
+                Abort("--count must be at least 1");
+            }
+            break;
+        case 'D':
+            daemon = true;
+            break;
+        case 'o':
+            outputFile = optarg;
+            break;
+        case 'z': {
+            char* end;
+            gRotateSize = strtoll(optarg, &end, 10);
+            switch (toupper(*end)) {
+            case 'K': gRotateSize <<= 10; end++; break;
+            case 'M': gRotateSize <<= 20; end++; break;
+            case 'G': gRotateSize <<= 30; end++; break;
+            }
+            if (gRotateSize < 1 || *end != '\0') {
+                Abort("invalid --rotate-size '%s'", optarg);
+            }
+            break;
+        }
+        case 'T':
+            gRotateTime_ns = int64_t(atoi(optarg)) * 1000000000;
+            if (gRotateTime_ns < 1) {
+                Abort("--rotate-time must be at least 1 s");
+            }
+            break;
+        case 'Z':
+            gCompress = true;
+            break;
+        case 'p':
+            pid = atoi(optarg);
+            if (pid <= 0) {
+                Abort("invalid --pid '%s'", optarg);
+            }
+            break;
+        case 'g':
+            cgroup = optarg;
+            break;
+        case 'r':
+            gSysfsRoot = optarg;
+            break;
+        case 'b':
+            if (strcmp(optarg, "auto") == 0) {
+                backend = RAPL::Auto;
+            } else if (strcmp(optarg, "perf") == 0) {
+                backend = RAPL::Perf;
+            } else if (strcmp(optarg, "msr") == 0) {
+                backend = RAPL::Msr;
+            } else {
+                Abort("unknown RAPL backend '%s'", optarg);
+            }
+            break;
+        case 'm': {
+            // This is used as a format string, so allow exactly one %d.
+            const char* conv = strchr(optarg, '%');
+            if (!conv || conv[1] != 'd' || strchr(conv + 2, '%')) {
+                Abort("--msr-path needs exactly one %%d and no other %%");
+            }
+            gMsrPathFormat = optarg;
+            break;
+        }
+        case 'C':
+            eventCache = optarg;
+            break;
+        case 'K':
+            dropCaches = true;
+            break;
+        case 'x':
+            multiplex = true;
+            break;
+        case 't':
+            perThread = true;
+            break;
+        case 'f':
+            if (strcmp(optarg, "csv") == 0) {
+                binary = false;
+            } else if (strcmp(optarg, "binary") == 0) {
+                binary = true;
+            } else {
+                Abort("unknown output format '%s'", optarg);
+            }
+            break;
+        case 'B':
+            batch = atoi(optarg);
+            if (batch < 1 || batch > kMaxBatch) {
+                Abort("--batch must be between 1 and %d", kMaxBatch);
+            }
+            break;
+        case 'R':
+            ringSize = atoi(optarg);
+            if (ringSize < 1) {
+                Abort("--ring-size must be at least 1");
+            }
+            break;
+        case 'S':
+            socketPath = optarg;
+            break;
+        case 'M':
+            metricsPort = atoi(optarg);
+            if (metricsPort < 1 || metricsPort > 65535) {
+                Abort("invalid --metrics-port '%s'", optarg);
+            }
+            break;
+        case 'O':
+            overheadColumn = true;
+            break;
+        case 'd':
+            dumpFile = optarg;
+            break;
+        case 'h':
+            Usage();
+            exit(0);
+        default:
+            Usage();
+            exit(1);
+        }
+    }
+    char** command = optind < argc ? argv + optind : NULL;
+    if (command && pid > 0) {
+        Abort("--pid and a command cannot be used together");
+    }
+    if (cgroup && !command) {
+        Abort("--cgroup needs a command");
+    }
+    if (perThread && !command && pid <= 0) {
+        Abort("--per-thread needs --pid or a command");
+    }
+    if (perThread && multiplex) {
+        Abort("--per-thread and --multiplex cannot be used together");
+    }
+    if (daemon && command) {
+        Abort("--daemon and a command cannot be used together");
+    }
+    if (overheadColumn && binary) {
+        Abort("--overhead needs --format=csv");
+    }
+
+    if (dumpFile) {
+        return DumpBinary(dumpFile, stdout);
+    }
+
+    InstallSignalHandlers();
+
+    char cacheDir[PATH_MAX];
+    const char* cacheHome = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (eventCache) {
+        gEventCacheDir = strcmp(eventCache, "none") == 0 ? NULL : eventCache;
+    } else if (cacheHome && cacheHome[0]) {
+        snprintf(cacheDir, sizeof(cacheDir), "%s/rp_t2", cacheHome);
+        gEventCacheDir = cacheDir;
+    } else if (home && home[0]) {
+        snprintf(cacheDir, sizeof(cacheDir), "%s/.cache/rp_t2", home);
+        gEventCacheDir = cacheDir;
+    }
+
+    if (dropCaches) {
+        DropCaches();
+    }
+
+    int64_t setupStart_ns = MonotonicNow_ns();
+    RaplSetup raplSetup = { backend, 0 };
+    pthread_t raplThread;
+    StartThread(&raplThread, SetUpRapl, &raplSetup);
+
+    InitPapi();
+    int64_t papiDone_ns = MonotonicNow_ns();
+
+    // The workload waits to be released until everything is ready.
+    int goFd = -1;
+    if (command) {
+        pid = ForkWorkload(command, &goFd);
+        if (cgroup) {
+            MoveToCgroup(pid, cgroup);
+        }
+    }
+
+    Counters* counters = new Counters(multiplex, /* aInherit = */ command != NULL);
+    if (numEventNames > 0) {
+        AddEvents(counters, eventNames, numEventNames, /* aStrict = */ true);
+    } else if (multiplex) {
+        AddEvents(counters, all_select_preset_events_name,
+                  sizeof(all_select_preset_events_name) /
+                  sizeof(all_select_preset_events_name[0]),
+                  /* aStrict = */ false);
+    } else {
+        SplitEventNames(strdup(kDefaultEvents), eventNames, numEventNames);
+        AddEvents(counters, eventNames, numEventNames, /* aStrict = */ false);
+    }
+    if (multiplex) {
+        fprintf(stderr, "multiplexing %d events over %d event sets\n",
+                counters->NumEvents(), counters->NumGroups());
+    }
+    if (pid > 0) {
+        int err = counters->Attach(pid);
+        if (err != PAPI_OK) {
+            Abort("PAPI_attach() to %d failed: %s", int(pid), PAPI_strerror(err));
+        }
+    }
+    if (!counters->Start()) {
+        Abort("PAPI_start error! \n");
+    }
+    int64_t eventsDone_ns = MonotonicNow_ns();
+
+    // The RAPL MSRs update every ~1 ms, but the measurement period isn't exactly
+    // 1 ms, which means the sample periods are not exact. "Power Measurement
+    // Techniques on Standard Compute Nodes: A Quantitative Comparison" by
+    // Hackenberg et al. suggests the following.
+    //
+    //   "RAPL provides energy (and not power) consumption data without
+    //   timestamps associated to each counter update. This makes sampling rates
+    //   above 20 Samples/s unfeasible if the systematic error should be below
+    //   5%... Constantly polling the RAPL registers will both occupy a processor
+    //   core and distort the measurement itself."
+    //
+    // So warn about this case.
+    //sampleInterval_msec = sampleInterval_msec/2;
+    if (sampleInterval_msec < 50) {
+        fprintf(stderr,
+                "\nWARNING: sample intervals < 50 ms are likely to produce "
+                "inaccurate estimates\n\n");
+    }
+
+    pthread_join(raplThread, NULL);
+
+    static SampleLayout layout;
+    layout.mInterval_msec = sampleInterval_msec;
+    layout.mNumEvents = counters->NumEvents();
+    for (int i = 0; i < layout.mNumEvents; i++) {
+        strncpy(layout.mEventNames[i], counters->Name(i), kMaxEventNameLen - 1);
+    }
+    layout.mHasScales = counters->IsMultiplexed();
+    layout.mHasOverhead = overheadColumn;
+    int numSockets = layout.mNumSockets = gRapl->NumSockets();
+    for (int i = 0; i < numSockets; i++) {
+        for (int d = 0; d < kNumDomains; d++) {
+            layout.mJoulesPerTick[i][d] = gRapl->JoulesPerTick(i, d);
+        }
+    }
+
+    char filename[256];
+    if (!outputFile) {
+        time_t itime = time(NULL);
+        struct tm* pt = localtime(&itime);
+        sprintf(filename, "util-power-%d-%d.%s", pt->tm_hour, pt->tm_min,
+                binary ? "bin" : "csv");
+        outputFile = filename;
+    }
+    Output* output;
+    if (binary) {
+        output = new BinaryOutput(outputFile, layout, batch);
+    } else {
+        output = new CsvOutput(outputFile, layout);
+    }
+    SampleWriter* writer = new SampleWriter(output, ringSize);
+
+    // The socket has a writer of its own, so that its clients and the file
+    // don't hold each other up. The metrics are updated by the sampler.
+    Output* socketOutput = NULL;
+    SampleWriter* socketWriter = NULL;
+    if (socketPath) {
+        socketOutput = new SocketOutput(socketPath, layout);
+        socketWriter = new SampleWriter(socketOutput, ringSize);
+    }
+    Output* metricsOutput = NULL;
+    if (metricsPort > 0) {
+        metricsOutput = new MetricsOutput(metricsPort, layout);
+    }
+
+    // The per-thread rows always go to a CSV file next to the main output.
+    ThreadCounters* threads = NULL;
+    Output* threadOutput = NULL;
+    SampleWriter* threadWriter = NULL;
+    if (perThread) {
+        char threadFile[PATH_MAX];
+        snprintf(threadFile, sizeof(threadFile), "%s.threads.csv", outputFile);
+        threads = new ThreadCounters(pid, counters);
+        threadOutput = new ThreadCsvOutput(threadFile, layout);
+        threadWriter = new SampleWriter(threadOutput, ringSize);
+    }
+
+    int64_t cgroupStart_usec = cgroup ? CgroupUsage_usec(cgroup) : -1;
+    if (command) {
+        StartWorkload(goFd);
+    }
+
+    IntervalTimer timer(sampleInterval_msec);
+    timer.Start();
+
+    static Sample sample;
+    static RunTotals totals;
+    // The time each stage of each sample took, leaving out the first
+    // reading, which only primes the baselines.
+    static LatencyHistogram papiTimes, raplTimes, pushTimes, threadTimes,
+                            sampleTimes;
+    int accu = 0;
+    int64_t firstReading_ns = 0;
+    while(true) {
+
+        // The measured length of the period that just ended; the first one
+        // is empty and only primes the PAPI and RAPL baselines.
+        sample.mInterval_ns = timer.Wait();
+        int64_t woke_ns = RawNow_ns();
+
+        // The counters are read back-to-back with the RAPL counters so that
+        // both cover the same window.
+        if (!counters->Read(sample.mInterval_ns, sample.mValues,
+                            sample.mScales)) {
+            Abort("PAPI_read error! \n");
+        }
+        int64_t papiRead_ns = RawNow_ns();
+
+        for (int i = 0; i < numSockets; i++) {
+            gRapl->Read(i, sample.mPackages[i]);
+        }
+        int64_t raplRead_ns = RawNow_ns();
+
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        sample.mTime_usec = int64_t(tv.tv_sec) * 1000000 + tv.tv_usec;
+        int64_t taken_ns = RawNow_ns();
+        sample.mOverhead_ns = taken_ns - woke_ns;
+
+        // The first sample takes a whole period after the baseline reading,
+        // so report both.
+        if (accu == 0) {
+            firstReading_ns = MonotonicNow_ns();
+        } else if (accu == 1) {
+            fprintf(stderr, "startup: first sample after %.1f ms, baseline "
+                    "after %.1f ms (PAPI init %.1f ms, events %.1f ms, RAPL "
+                    "%.1f ms alongside)\n",
+                    (MonotonicNow_ns() - start_ns) / 1e6,
+                    (firstReading_ns - start_ns) / 1e6,
+                    (papiDone_ns - setupStart_ns) / 1e6,
+                    (eventsDone_ns - papiDone_ns) / 1e6,
+                    raplSetup.mTime_ns / 1e6);
+        }
+
+        //fix the first power records all are 0
+        if (accu > 0) {
+            sample.mSeq = uint64_t(accu - 1);
+            writer->Push(sample);
+            if (socketWriter) {
+                socketWriter->Push(sample);
+            }
+            if (metricsOutput) {
+                metricsOutput->Write(sample);
+            }
+            totals.Add(layout, sample);
+            papiTimes.Add(papiRead_ns - woke_ns);
+            raplTimes.Add(raplRead_ns - papiRead_ns);
+            pushTimes.Add(RawNow_ns() - taken_ns);
+        }
+        if (threads) {
+            int64_t threadStart_ns = RawNow_ns();
+            threads->Read(sample, accu > 0, threadWriter);
+            threads->Scan();
+            if (accu > 0) {
+                threadTimes.Add(RawNow_ns() - threadStart_ns);
+            }
+        }
+        if (gRotate) {
+            gRotate = 0;
+            writer->Rotate();
+            if (threadWriter) {
+                threadWriter->Rotate();
+            }
+        }
+        if (accu > 0) {
+            sampleTimes.Add(RawNow_ns() - woke_ns);
+        }
+
+        // With a command, run until it exits, and as a daemon until a signal.
+        if (gStop || (!command && !daemon && accu >= sampleCount)) {
+            if (!counters->Stop()) {
+                Abort("PAPI_stop error \n");
+            }
+            break;
+        }
+        accu++;
+    }
+    delete writer;
+    delete socketWriter;
+    delete threads;
+    delete threadWriter;
+    delete counters;
+    delete gRapl;
+    PAPI_shutdown();
+    timer.PrintStats(stderr);
+
+    // What the monitor itself cost: the sampler's stages, the writers' and
+    // the CPU time of every thread (a workload's is its own, as a child).
+    papiTimes.Print(stderr, "papi read");
+    raplTimes.Print(stderr, "rapl read");
+    pushTimes.Print(stderr, "push");
+    threadTimes.Print(stderr, "per-thread");
+    sampleTimes.Print(stderr, "whole sample");
+    output->mFormatTimes.Print(stderr, binary ? "binary format" : "csv format");
+    output->mWriteTimes.Print(stderr, binary ? "binary write" : "csv write");
+    if (socketOutput) {
+        socketOutput->mFormatTimes.Print(stderr, "socket format");
+        socketOutput->mWriteTimes.Print(stderr, "socket send");
+    }
+    if (threadOutput) {
+        threadOutput->mFormatTimes.Print(stderr, "threads format");
+        threadOutput->mWriteTimes.Print(stderr, "threads write");
+    }
+    struct rusage self, sampler;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_THREAD, &sampler);
+    double user_sec = self.ru_utime.tv_sec + self.ru_utime.tv_usec / 1e6;
+    double system_sec = self.ru_stime.tv_sec + self.ru_stime.tv_usec / 1e6;
+    double sampler_sec = sampler.ru_utime.tv_sec + sampler.ru_stime.tv_sec +
+                         (sampler.ru_utime.tv_usec + sampler.ru_stime.tv_usec) / 1e6;
+    double wall_sec = (MonotonicNow_ns() - start_ns) / 1e9;
+    fprintf(stderr, "overhead: CPU time %.3f s user, %.3f s system, %.3f s "
+            "in the sampler, %.3f%% of one CPU over %.3f s\n",
+            user_sec, system_sec, sampler_sec,
+            100 * (user_sec + system_sec) / wall_sec, wall_sec);
+    // Charging the monitor the package power in proportion to the share of
+    // the machine's CPU time it used is rough, but gives a scale.
+    if (totals.mEnergy_J[kPkg] != kUnsupported_j && totals.mDuration_ns > 0) {
+        double pkg_W = totals.mEnergy_J[kPkg] / (totals.mDuration_ns / 1e9);
+        fprintf(stderr, "overhead: about %.3f J of package energy, by share of "
+                "CPU time\n",
+                (user_sec + system_sec) / sysconf(_SC_NPROCESSORS_ONLN) * pkg_W);
+    }
+    delete output;
+    delete socketOutput;
+    delete metricsOutput;
+    delete threadOutput;
+
+    int exitStatus = 0;
+    if (command) {
+        int status;
+        if (waitpid(pid, &status, 0) != pid) {
+            Abort("waitpid() failed: %s", strerror(errno));
+        }
+        if (WIFEXITED(status)) {
+            exitStatus = WEXITSTATUS(status);
+            fprintf(stderr, "%s exited with status %d\n", command[0], exitStatus);
+        } else {
+            exitStatus = 128 + WTERMSIG(status);
+            fprintf(stderr, "%s killed by signal %d\n", command[0],
+                    WTERMSIG(status));
+        }
+        totals.Print(stderr, layout);
+        int64_t cgroupEnd_usec = cgroup ? CgroupUsage_usec(cgroup) : -1;
+        if (cgroupStart_usec >= 0 && cgroupEnd_usec >= 0) {
+            fprintf(stderr, "total: cgroup CPU time %.3f s\n",
+                    (cgroupEnd_usec - cgroupStart_usec) / 1e6);
+        }
     }
-    fclose(fp);
     printf("finshed");
-    return 0;
+    return exitStatus;
 }
@@ -0,0 +1,430 @@
+#include "sort.h"
+#include "workers.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct _Range {
+    int start, end;
+} Range;
+
+Range new_Range(int s, int e) {
+    Range r;
+    r.start = s;
+    r.end = e;
+    return r;
+}
+static void swap(int *x, int *y) {
+    int t = *x;
+    *x = *y;
+    *y = t;
+}
+
+void quick_sort(int arr[], const int len) {
+    if (len <= 0)
+        return; //避免len等於負值時宣告堆疊陣列當機
+    //r[]模擬堆疊,p為數量,r[p++]為push,r[--p]為pop且取得元素
+    // The smaller half is pushed last, so it's sorted first and the stack
+    // never holds more than log2(len) + 1 ranges.
+    Range r[2 * sizeof(int) * 8];
+    int p = 0;
+    r[p++] = new_Range(0, len - 1);
+    while (p) {
+        Range range = r[--p];
+        if (range.start >= range.end)
+            continue;
+        int mid = arr[range.end];
+        int left = range.start, right = range.end - 1;
+        while (left < right) {
+            while (arr[left] < mid && left < right)
+                left++;
+            while (arr[right] >= mid && left < right)
+                right--;
+            swap(&arr[left], &arr[right]);
+        }
+        if (arr[left] >= arr[range.end])
+            swap(&arr[left], &arr[range.end]);
+        else
+            left++;
+        if (left - range.start > range.end - left) {
+            r[p++] = new_Range(range.start, left - 1);
+            r[p++] = new_Range(left + 1, range.end);
+        } else {
+            r[p++] = new_Range(left + 1, range.end);
+            r[p++] = new_Range(range.start, left - 1);
+        }
+    }
+}
+
+void bubble_sort(int arr[], int len) {
+    int i, j, temp;
+    for (i = 0; i < len - 1; i++)
+        for (j = 0; j < len - 1 - i; j++)
+            if (arr[j] > arr[j + 1]) {
+                temp = arr[j];
+                arr[j] = arr[j + 1];
+                arr[j + 1] = temp;
+            }
+}
+
+static void max_heapify(int arr[], int start, int end) {
+    //建立父節點指標和子節點指標
+    int dad = start;
+    int son = dad * 2 + 1;
+    while (son <= end) { //若子節點指標在範圍內才做比較
+        if (son + 1 <= end && arr[son] < arr[son + 1]) //先比較兩個子節點大小，選擇最大的
+            son++;
+        if (arr[dad] > arr[son]) //如果父節點大於子節點代表調整完畢，直接跳出函數
+            return;
+        else { //否則交換父子內容再繼續子節點和孫節點比較
+            swap(&arr[dad], &arr[son]);
+            dad = son;
+            son = dad * 2 + 1;
+        }
+    }
+}
+
+void heap_sort(int arr[], int len) {
+    int i;
+    //初始化，i從最後一個父節點開始調整
+    for (i = len / 2 - 1; i >= 0; i--)
+        max_heapify(arr, i, len - 1);
+    //先將第一個元素和已排好元素前一位做交換，再從新調整，直到排序完畢
+    for (i = len - 1; i > 0; i--) {
+        swap(&arr[0], &arr[i]);
+        max_heapify(arr, 0, i - 1);
+    }
+}
+
+// Ranges this short are finished with insertion sort.
+static const size_t kInsertionSortMax = 16;
+
+static void
+InsertionSort(int* aData, size_t aLen)
+{
+    for (size_t i = 1; i < aLen; i++) {
+        int key = aData[i];
+        size_t j = i;
+        for (; j > 0 && aData[j - 1] > key; j--) {
+            aData[j] = aData[j - 1];
+        }
+        aData[j] = key;
+    }
+}
+
+static void
+SiftDown(int* aData, size_t aStart, size_t aLen)
+{
+    size_t parent = aStart;
+    for (size_t child = 2 * parent + 1; child < aLen; child = 2 * parent + 1) {
+        if (child + 1 < aLen && aData[child] < aData[child + 1]) {
+            child++;
+        }
+        if (aData[parent] >= aData[child]) {
+            return;
+        }
+        swap(&aData[parent], &aData[child]);
+        parent = child;
+    }
+}
+
+static void
+HeapSort(int* aData, size_t aLen)
+{
+    for (size_t i = aLen / 2; i > 0; i--) {
+        SiftDown(aData, i - 1, aLen);
+    }
+    for (size_t i = aLen - 1; i > 0; i--) {
+        swap(&aData[0], &aData[i]);
+        SiftDown(aData, 0, i);
+    }
+}
+
+// Partitions |aData| around the median of its first, middle and last keys,
+// Hoare's way, and returns the length of the first part. Both parts are
+// non-empty, and no key in the first is greater than any key in the second.
+static size_t
+Partition(int* aData, size_t aLen)
+{
+    size_t mid = (aLen - 1) / 2;
+    if (aData[mid] < aData[0]) {
+        swap(&aData[mid], &aData[0]);
+    }
+    if (aData[aLen - 1] < aData[0]) {
+        swap(&aData[aLen - 1], &aData[0]);
+    }
+    if (aData[aLen - 1] < aData[mid]) {
+        swap(&aData[aLen - 1], &aData[mid]);
+    }
+    int pivot = aData[mid];
+
+    // The keys at 0 and aLen - 1 stop the scans from running off the ends.
+    size_t i = 0, j = aLen - 1;
+    while (true) {
+        while (aData[++i] < pivot) {
+        }
+        while (aData[--j] > pivot) {
+        }
+        if (i >= j) {
+            return j + 1;
+        }
+        swap(&aData[i], &aData[j]);
+    }
+}
+
+void
+IntroSort(int* aData, size_t aLen)
+{
+    struct Range
+    {
+        size_t mStart;
+        size_t mLen;
+        int mDepth;                 // Partitions left before heapsort.
+    };
+
+    // The larger part of each partition is pushed and the smaller one sorted
+    // next, so every range on the stack is at least twice the size of the
+    // one above it.
+    Range stack[sizeof(size_t) * 8];
+    int depth = 0;
+    for (size_t n = aLen; n > 1; n >>= 1) {
+        depth += 2;
+    }
+    int top = 0;
+    Range range = { 0, aLen, depth };
+    while (true) {
+        while (range.mLen > kInsertionSortMax) {
+            int* data = aData + range.mStart;
+            if (range.mDepth == 0) {
+                HeapSort(data, range.mLen);
+                range.mLen = 0;
+                break;
+            }
+            size_t split = Partition(data, range.mLen);
+            Range left = { range.mStart, split, range.mDepth - 1 };
+            Range right = { range.mStart + split, range.mLen - split,
+                            range.mDepth - 1 };
+            if (left.mLen > right.mLen) {
+                stack[top++] = left;
+                range = right;
+            } else {
+                stack[top++] = right;
+                range = left;
+            }
+        }
+        InsertionSort(aData + range.mStart, range.mLen);
+        if (top == 0) {
+            break;
+        }
+        range = stack[--top];
+    }
+}
+
+void
+RadixSort(int* aData, size_t aLen, int* aScratch)
+{
+    // Flipping the sign bit makes the keys sort as unsigned numbers.
+    static const uint32_t kSignBit = 0x80000000;
+    size_t counts[4][256];
+    memset(counts, 0, sizeof(counts));
+    for (size_t i = 0; i < aLen; i++) {
+        uint32_t key = uint32_t(aData[i]) ^ kSignBit;
+        counts[0][key & 0xff]++;
+        counts[1][(key >> 8) & 0xff]++;
+        counts[2][(key >> 16) & 0xff]++;
+        counts[3][key >> 24]++;
+    }
+
+    int* from = aData;
+    int* to = aScratch;
+    for (int pass = 0; pass < 4; pass++) {
+        int shift = pass * 8;
+        size_t offsets[256];
+        size_t offset = 0;
+        bool skip = false;
+        for (int d = 0; d < 256; d++) {
+            if (counts[pass][d] == aLen) {
+                skip = true;
+                break;
+            }
+            offsets[d] = offset;
+            offset += counts[pass][d];
+        }
+        if (skip) {
+            continue;
+        }
+        for (size_t i = 0; i < aLen; i++) {
+            uint32_t key = uint32_t(from[i]) ^ kSignBit;
+            to[offsets[(key >> shift) & 0xff]++] = from[i];
+        }
+        int* t = from;
+        from = to;
+        to = t;
+    }
+    if (from != aData) {
+        memcpy(aData, from, aLen * sizeof(int));
+    }
+}
+
+// Below this, sorting on one thread is faster than starting the others.
+static const size_t kSampleSortMin = 1 << 14;
+// The sample has this many keys per splitter.
+static const int kOversample = 64;
+
+struct SampleSortShared
+{
+    int* mData;
+    int* mScratch;
+    size_t mLen;
+    int mNumThreads;
+    int* mSplitters;                // mNumThreads - 1 of them.
+    size_t* mCounts;                // [thread][bucket]
+    size_t* mBucketStart;           // mNumThreads + 1 of them.
+    pthread_barrier_t mBarrier;
+};
+
+struct SampleSortWorker
+{
+    SampleSortShared* mShared;
+    int mIndex;
+    pthread_t mThread;
+};
+
+static inline int
+FindBucket(const int* aSplitters, int aNumSplitters, int aKey)
+{
+    // The first splitter greater than the key.
+    int low = 0, high = aNumSplitters;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (aSplitters[mid] <= aKey) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static void*
+RunSampleSortWorker(void* aArg)
+{
+    SampleSortWorker* worker = (SampleSortWorker*)aArg;
+    SampleSortShared* shared = worker->mShared;
+    int numThreads = shared->mNumThreads;
+    size_t start = shared->mLen * worker->mIndex / numThreads;
+    size_t end = shared->mLen * (worker->mIndex + 1) / numThreads;
+    size_t* counts = shared->mCounts + size_t(worker->mIndex) * numThreads;
+
+    for (size_t i = start; i < end; i++) {
+        counts[FindBucket(shared->mSplitters, numThreads - 1,
+                          shared->mData[i])]++;
+    }
+    pthread_barrier_wait(&shared->mBarrier);
+
+    // Thread 0 works out where each thread's share of each bucket goes.
+    if (worker->mIndex == 0) {
+        size_t offset = 0;
+        for (int b = 0; b < numThreads; b++) {
+            shared->mBucketStart[b] = offset;
+            for (int t = 0; t < numThreads; t++) {
+                size_t count = shared->mCounts[size_t(t) * numThreads + b];
+                shared->mCounts[size_t(t) * numThreads + b] = offset;
+                offset += count;
+            }
+        }
+        shared->mBucketStart[numThreads] = offset;
+    }
+    pthread_barrier_wait(&shared->mBarrier);
+
+    for (size_t i = start; i < end; i++) {
+        int key = shared->mData[i];
+        shared->mScratch[counts[FindBucket(shared->mSplitters, numThreads - 1,
+                                           key)]++] = key;
+    }
+    pthread_barrier_wait(&shared->mBarrier);
+
+    size_t bucketStart = shared->mBucketStart[worker->mIndex];
+    size_t bucketLen = shared->mBucketStart[worker->mIndex + 1] - bucketStart;
+    IntroSort(shared->mScratch + bucketStart, bucketLen);
+    memcpy(shared->mData + bucketStart, shared->mScratch + bucketStart,
+           bucketLen * sizeof(int));
+    return NULL;
+}
+
+void
+SampleSort(int* aData, size_t aLen, int aNumThreads)
+{
+    if (aNumThreads <= 1 || aLen < kSampleSortMin) {
+        IntroSort(aData, aLen);
+        return;
+    }
+
+    // The sample is spread evenly over the data, so it is deterministic.
+    int numSamples = aNumThreads * kOversample;
+    int* samples = new int[numSamples];
+    for (int i = 0; i < numSamples; i++) {
+        samples[i] = aData[(aLen / numSamples) * i + (aLen / numSamples) / 2];
+    }
+    IntroSort(samples, numSamples);
+
+    SampleSortShared shared;
+    shared.mData = aData;
+    shared.mScratch = new int[aLen];
+    shared.mLen = aLen;
+    shared.mNumThreads = aNumThreads;
+    shared.mSplitters = new int[aNumThreads - 1];
+    for (int i = 1; i < aNumThreads; i++) {
+        shared.mSplitters[i - 1] = samples[i * kOversample];
+    }
+    shared.mCounts = new size_t[size_t(aNumThreads) * aNumThreads]();
+    shared.mBucketStart = new size_t[aNumThreads + 1];
+    pthread_barrier_init(&shared.mBarrier, NULL, aNumThreads);
+
+    SampleSortWorker* workers = new SampleSortWorker[aNumThreads];
+    for (int i = 0; i < aNumThreads; i++) {
+        workers[i].mShared = &shared;
+        workers[i].mIndex = i;
+    }
+    RunWorkers(workers, aNumThreads, RunSampleSortWorker, "SampleSort");
+
+    pthread_barrier_destroy(&shared.mBarrier);
+    delete[] workers;
+    delete[] shared.mBucketStart;
+    delete[] shared.mCounts;
+    delete[] shared.mSplitters;
+    delete[] shared.mScratch;
+    delete[] samples;
+}
+
+const char* const kSortInputNames[kNumSortInputs] = {
+    "random", "sorted", "reversed", "duplicates"
+};
+
+void
+MakeSortInput(int* aData, size_t aLen, SortInput aInput, uint64_t aSeed)
+{
+    // xorshift64*, as in the load driver.
+    uint64_t state = aSeed * 0x9E3779B97F4A7C15ULL | 1;
+    for (size_t i = 0; i < aLen; i++) {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        uint32_t random = uint32_t((state * 2685821657736338717ULL) >> 32);
+        switch (aInput) {
+        case kRandomInput:
+            aData[i] = int(random);
+            break;
+        case kSortedInput:
+            aData[i] = int(i - aLen / 2);
+            break;
+        case kReversedInput:
+            aData[i] = int(aLen / 2 - i);
+            break;
+        default:
+            aData[i] = int(random % 16);
+            break;
+        }
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The original sorts from load.cpp.
+void quick_sort(int arr[], const int len);
+void bubble_sort(int arr[], int len);
+void heap_sort(int arr[], int len);
+
+// Sorts |aData| with an introsort: quicksort with a median-of-three pivot
+// that switches to heapsort if it partitions badly, and finishes small ranges
+// with insertion sort. It keeps its ranges on a fixed-size stack instead of
+// recursing, so it never uses more than a few hundred bytes of stack.
+void IntroSort(int* aData, size_t aLen);
+
+// Sorts |aData| with a least-significant-digit radix sort, a byte per pass,
+// using |aScratch|, which must have room for |aLen| ints. Passes in which every
+// key has the same digit are skipped.
+void RadixSort(int* aData, size_t aLen, int* aScratch);
+
+// Sorts |aData| on |aNumThreads| threads: a sample of the data picks a
+// splitter per thread, each thread distributes its share of the data into the
+// splitters' buckets, and then sorts one bucket with IntroSort(). Inputs with
+// many equal keys can leave the buckets unbalanced.
+void SampleSort(int* aData, size_t aLen, int aNumThreads);
+
+// The inputs the sort benchmark and the load driver's sort kernels use.
+enum SortInput {
+    kRandomInput,
+    kSortedInput,
+    kReversedInput,
+    kDuplicatesInput,               // Only 16 different keys.
+    kNumSortInputs
+};
+extern const char* const kSortInputNames[kNumSortInputs];
+
+// Fills |aData| with |aLen| keys of the kind |aInput|. Random keys depend only
+// on |aSeed|.
+void MakeSortInput(int* aData, size_t aLen, SortInput aInput, uint64_t aSeed);
+
+#endif // SORT_H
@@ -0,0 +1,288 @@
+#include "stream.h"
+#include "workers.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define STREAM_HAVE_AVX2 1
+#endif
+
+double_array fpeak(double_array a, double_array b)
+{
+    int arr_len = sizeof(a.arr)/sizeof(a.arr[0]);
+    double_array sum;
+    memset(sum.arr, 0, sizeof(sum.arr));
+    for(int i = 0; i < arr_len; i++) {
+        sum.arr[i] = a.arr[i] + b.arr[i];
+    }
+    return sum;
+}
+
+const StreamOpInfo kStreamOps[kNumStreamOps] = {
+    { "copy",  16, 0 },
+    { "scale", 16, 1 },
+    { "add",   24, 1 },
+    { "triad", 24, 2 },
+};
+
+// STREAM uses 3, which makes the values grow by 15 times with each round of
+// the four ops. With this scalar, 2s + s^2 = 1, so a round leaves them where
+// they were, and the load driver can run rounds forever without the values
+// overflowing or going denormal.
+static const double kScalar = 0.41421356237309515;
+
+// The slices start on 64-byte lines.
+static const size_t kLineDoubles = 8;
+
+struct Stream::Worker
+{
+    Stream* mStream;
+    int mIndex;
+    pthread_t mThread;
+};
+
+static void
+SliceBounds(size_t aCount, int aIndex, int aNumThreads, size_t* aStart,
+            size_t* aEnd)
+{
+    size_t lines = aCount / kLineDoubles;
+    *aStart = lines * aIndex / aNumThreads * kLineDoubles;
+    *aEnd = aIndex == aNumThreads - 1
+            ? aCount : lines * (aIndex + 1) / aNumThreads * kLineDoubles;
+}
+
+static void
+RunOp(StreamOp aOp, double* aA, double* aB, double* aC, size_t aStart,
+      size_t aEnd)
+{
+    switch (aOp) {
+    case kStreamCopy:
+        for (size_t i = aStart; i < aEnd; i++) {
+            aC[i] = aA[i];
+        }
+        break;
+    case kStreamScale:
+        for (size_t i = aStart; i < aEnd; i++) {
+            aB[i] = kScalar * aC[i];
+        }
+        break;
+    case kStreamAdd:
+        for (size_t i = aStart; i < aEnd; i++) {
+            aC[i] = aA[i] + aB[i];
+        }
+        break;
+    case kStreamTriad:
+        for (size_t i = aStart; i < aEnd; i++) {
+            aA[i] = aB[i] + kScalar * aC[i];
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+#ifdef STREAM_HAVE_AVX2
+// The same loops, eight doubles at a time. The triad multiplies and adds
+// separately, as the scalar loop does, rather than with an FMA.
+__attribute__((target("avx2")))
+static void
+RunOpAVX2(StreamOp aOp, double* aA, double* aB, double* aC, size_t aStart,
+          size_t aEnd)
+{
+    __m256d s = _mm256_set1_pd(kScalar);
+    size_t i = aStart;
+    size_t end = aStart + (aEnd - aStart) / 8 * 8;
+    switch (aOp) {
+    case kStreamCopy:
+        for (; i < end; i += 8) {
+            _mm256_store_pd(aC + i, _mm256_load_pd(aA + i));
+            _mm256_store_pd(aC + i + 4, _mm256_load_pd(aA + i + 4));
+        }
+        break;
+    case kStreamScale:
+        for (; i < end; i += 8) {
+            _mm256_store_pd(aB + i, _mm256_mul_pd(s, _mm256_load_pd(aC + i)));
+            _mm256_store_pd(aB + i + 4,
+                            _mm256_mul_pd(s, _mm256_load_pd(aC + i + 4)));
+        }
+        break;
+    case kStreamAdd:
+        for (; i < end; i += 8) {
+            _mm256_store_pd(aC + i, _mm256_add_pd(_mm256_load_pd(aA + i),
+                                                  _mm256_load_pd(aB + i)));
+            _mm256_store_pd(aC + i + 4,
+                            _mm256_add_pd(_mm256_load_pd(aA + i + 4),
+                                          _mm256_load_pd(aB + i + 4)));
+        }
+        break;
+    case kStreamTriad:
+        for (; i < end; i += 8) {
+            _mm256_store_pd(aA + i,
+                _mm256_add_pd(_mm256_load_pd(aB + i),
+                              _mm256_mul_pd(s, _mm256_load_pd(aC + i))));
+            _mm256_store_pd(aA + i + 4,
+                _mm256_add_pd(_mm256_load_pd(aB + i + 4),
+                              _mm256_mul_pd(s, _mm256_load_pd(aC + i + 4))));
+        }
+        break;
+    default:
+        break;
+    }
+    // The tail runs in the scalar loop, which is SSE code in a build without
+    // -mavx2, and SSE code after dirty upper YMM halves pays a transition
+    // penalty on every instruction, here and in the caller.
+    _mm256_zeroupper();
+    RunOp(aOp, aA, aB, aC, i, aEnd);
+}
+#endif
+
+static double*
+AllocateArray(size_t aCount)
+{
+    void* p;
+    int err = posix_memalign(&p, kLineDoubles * sizeof(double),
+                             (aCount > 0 ? aCount : 1) * sizeof(double));
+    if (err != 0) {
+        fprintf(stderr, "Stream: can't allocate %zu doubles: %s\n", aCount,
+                strerror(err));
+        abort();
+    }
+    return (double*)p;
+}
+
+void
+Stream::RunSlice(int aIndex)
+{
+    size_t start, end;
+    SliceBounds(mCount, aIndex, mNumThreads, &start, &end);
+    for (long r = 0; r < mReps; r++) {
+#ifdef STREAM_HAVE_AVX2
+        if (mUseAVX2) {
+            RunOpAVX2(mOp, mA, mB, mC, start, end);
+            continue;
+        }
+#endif
+        RunOp(mOp, mA, mB, mC, start, end);
+    }
+}
+
+void*
+Stream::RunWorker(void* aArg)
+{
+    Worker* worker = (Worker*)aArg;
+    Stream* stream = worker->mStream;
+    size_t start, end;
+    SliceBounds(stream->mCount, worker->mIndex, stream->mNumThreads, &start,
+                &end);
+    for (size_t i = start; i < end; i++) {
+        stream->mA[i] = 1;
+        stream->mB[i] = 2;
+        stream->mC[i] = 0;
+    }
+    pthread_barrier_wait(&stream->mBarrier);
+
+    for (;;) {
+        pthread_barrier_wait(&stream->mBarrier);
+        if (stream->mQuit) {
+            return NULL;
+        }
+        stream->RunSlice(worker->mIndex);
+        pthread_barrier_wait(&stream->mBarrier);
+    }
+}
+
+Stream::Stream(size_t aCount, int aNumThreads)
+  : mCount(aCount), mNumThreads(aNumThreads > 0 ? aNumThreads : 1),
+    mUseAVX2(false), mExpectA(1), mExpectB(2), mExpectC(0),
+    mOp(kStreamCopy), mReps(0), mQuit(false)
+{
+#ifdef STREAM_HAVE_AVX2
+    mUseAVX2 = __builtin_cpu_supports("avx2");
+#endif
+    mA = AllocateArray(aCount);
+    mB = AllocateArray(aCount);
+    mC = AllocateArray(aCount);
+    pthread_barrier_init(&mBarrier, NULL, mNumThreads);
+
+    // This thread is worker 0, and does its share of Run() itself.
+    mWorkers = new Worker[mNumThreads];
+    for (int i = 0; i < mNumThreads; i++) {
+        mWorkers[i].mStream = this;
+        mWorkers[i].mIndex = i;
+    }
+    StartWorkers(mWorkers, mNumThreads, RunWorker, "Stream");
+    size_t start, end;
+    SliceBounds(mCount, 0, mNumThreads, &start, &end);
+    for (size_t i = start; i < end; i++) {
+        mA[i] = 1;
+        mB[i] = 2;
+        mC[i] = 0;
+    }
+    pthread_barrier_wait(&mBarrier);
+}
+
+Stream::~Stream()
+{
+    mQuit = true;
+    pthread_barrier_wait(&mBarrier);
+    JoinWorkers(mWorkers, mNumThreads);
+    pthread_barrier_destroy(&mBarrier);
+    delete[] mWorkers;
+    free(mA);
+    free(mB);
+    free(mC);
+}
+
+void
+Stream::Run(StreamOp aOp, long aReps)
+{
+    if (aReps < 1) {
+        return;
+    }
+    mOp = aOp;
+    mReps = aReps;
+    pthread_barrier_wait(&mBarrier);
+    RunSlice(0);
+    pthread_barrier_wait(&mBarrier);
+
+    // Repeating an op gives the same values as running it once.
+    switch (aOp) {
+    case kStreamCopy:
+        mExpectC = mExpectA;
+        break;
+    case kStreamScale:
+        mExpectB = kScalar * mExpectC;
+        break;
+    case kStreamAdd:
+        mExpectC = mExpectA + mExpectB;
+        break;
+    case kStreamTriad:
+        mExpectA = mExpectB + kScalar * mExpectC;
+        break;
+    default:
+        break;
+    }
+}
+
+static bool
+Close(double aValue, double aExpected)
+{
+    return fabs(aValue - aExpected) <= 1e-13 * fabs(aExpected);
+}
+
+bool
+Stream::Check() const
+{
+    for (size_t i = 0; i < mCount; i++) {
+        if (!Close(mA[i], mExpectA) || !Close(mB[i], mExpectB) ||
+            !Close(mC[i], mExpectC)) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,83 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+// The original fpeak() from load.cpp. It passes two 8 KB structs and returns
+// a third by value, so it mostly measures copying them on the stack.
+typedef struct {
+    double arr[1000];
+} double_array;
+
+double_array fpeak(double_array a, double_array b);
+
+// The four loops of the STREAM benchmark, over arrays a, b and c and a scalar
+// s. Each moves mBytes and does mFlops floating-point operations per element,
+// counted the way STREAM counts them: without the reads that writing a line
+// into the cache can take.
+enum StreamOp {
+    kStreamCopy,                    // c = a
+    kStreamScale,                   // b = s * c
+    kStreamAdd,                     // c = a + b
+    kStreamTriad,                   // a = b + s * c
+    kNumStreamOps
+};
+
+struct StreamOpInfo
+{
+    const char* mName;
+    int mBytes;
+    int mFlops;
+};
+extern const StreamOpInfo kStreamOps[kNumStreamOps];
+
+// This class owns the three arrays and the threads that sweep them. Each
+// thread has a slice of every array, which it writes first so that the pages
+// are local to it, and the slices start on cache lines so that the threads
+// don't share any.
+class Stream
+{
+    size_t mCount;
+    int mNumThreads;
+    double* mA;
+    double* mB;
+    double* mC;
+    bool mUseAVX2;
+    // What the elements should be, worked out on the side for Check().
+    double mExpectA, mExpectB, mExpectC;
+
+    // The threads other than the caller wait for each Run() at the barrier.
+    struct Worker;
+    Worker* mWorkers;
+    pthread_barrier_t mBarrier;
+    StreamOp mOp;
+    long mReps;
+    bool mQuit;
+
+    static void* RunWorker(void* aArg);
+    void RunSlice(int aIndex);
+
+public:
+    // Allocates three arrays of |aCount| doubles for |aNumThreads| threads.
+    Stream(size_t aCount, int aNumThreads);
+    ~Stream();
+
+    size_t Count() const { return mCount; }
+    int NumThreads() const { return mNumThreads; }
+    const double* A() const { return mA; }
+
+    // Turns the AVX2 loops off, to compare them with the scalar ones.
+    void DisableAVX2() { mUseAVX2 = false; }
+    bool UsesAVX2() const { return mUseAVX2; }
+
+    // Runs |aOp| over the whole arrays |aReps| times. Each thread repeats it
+    // on its own slice, so a small array stays in the threads' caches.
+    void Run(StreamOp aOp, long aReps = 1);
+
+    // Returns whether every element has the value the ops so far should
+    // have given it.
+    bool Check() const;
+};
+
+#endif // STREAM_H
@@ -0,0 +1,54 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The small thread pools of the parallel kernels. A pool is an array of
+// worker structs, each with an |mThread| member, and the calling thread is
+// always worker 0, so a pool of one starts no threads at all. |aWho| names
+// the kernel in the message printed if a thread can't be started, which
+// aborts, as there is no way to run the kernel without it.
+
+// Starts |aMain| on its own thread for each worker but the first.
+template <typename Worker>
+void
+StartWorkers(Worker* aWorkers, int aNumWorkers, void* (*aMain)(void*),
+             const char* aWho)
+{
+    for (int i = 1; i < aNumWorkers; i++) {
+        int err = pthread_create(&aWorkers[i].mThread, NULL, aMain,
+                                 &aWorkers[i]);
+        if (err != 0) {
+            fprintf(stderr, "%s: pthread_create() failed: %s\n", aWho,
+                    strerror(err));
+            abort();
+        }
+    }
+}
+
+// Joins every worker but the first.
+template <typename Worker>
+void
+JoinWorkers(Worker* aWorkers, int aNumWorkers)
+{
+    for (int i = 1; i < aNumWorkers; i++) {
+        pthread_join(aWorkers[i].mThread, NULL);
+    }
+}
+
+// Runs |aMain| for every worker, the first on this thread, and returns once
+// they have all finished.
+template <typename Worker>
+void
+RunWorkers(Worker* aWorkers, int aNumWorkers, void* (*aMain)(void*),
+           const char* aWho)
+{
+    StartWorkers(aWorkers, aNumWorkers, aMain, aWho);
+    aMain(&aWorkers[0]);
+    JoinWorkers(aWorkers, aNumWorkers);
+}
+
+#endif // WORKERS_H